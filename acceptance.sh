@@ -445,6 +445,9 @@ function hsm_import()
 
 function kill_copytool()
 {
+    # the test may have restarted the copytool
+    ((COPYTOOL_PID)) || return 0
+
     if ! $USE_DAEMON
     then
         kill $COPYTOOL_PID || error "Copytool process was not running"
@@ -598,6 +601,76 @@ function test_archive_release_restore()
 }
 add_test archive_release_restore
 
+function test_fullpath_in_user_md()
+{
+    local dir="$test_dir/dir"
+    local files=("$dir/file1" "$dir/file2")
+    local file
+
+    mkdir "$dir"
+    for file in "${files[@]}"; do
+        create_file "$file"
+    done
+
+    add_event_watch
+    start_copytool
+
+    # the path of the parent directory is resolved once for both files
+    for file in "${files[@]}"; do
+        lfs hsm_archive "$file"
+        wait_for_event ARCHIVE_FINISH "$file"
+
+        phobos -q getmd "$(get_oid_from_path "$file")" | grep -qF "$file" ||
+            invalid_file_attr "$file" "$file"
+    done
+}
+add_test fullpath_in_user_md
+
+function get_data_version()
+{
+    phobos -q getmd "$(get_oid_from_path "$1")" |
+        grep -o '"data_version": *"[0-9]*"' | grep -o '[0-9]*"$'
+}
+
+function test_archive_unchanged()
+{
+    local file="$test_dir/file"
+
+    create_file "$file"
+
+    add_event_watch
+    start_copytool
+
+    lfs hsm_archive "$file"
+    wait_for_event ARCHIVE_FINISH "$file"
+
+    local version=$(get_data_version "$file")
+    [[ -n $version ]] || error "No data version in the user_md of '$file'"
+
+    # a dirty file holding the same data leaves the object as it is; the
+    # events of the previous archive must not be waited for again
+    truncate -s 0 "$EVENTS"
+    lfs hsm_set --dirty "$file"
+    lfs hsm_archive "$file"
+    wait_for_event ARCHIVE_FINISH "$file"
+    grep -a "is unchanged since it was archived" "$EVENTS" ||
+        error "'$file' should have been found unchanged"
+    lfs hsm_state "$file" | grep -q archived ||
+        error "'$file' should still be archived"
+    [[ $(get_data_version "$file") == $version ]] ||
+        error "'$file' should not have been archived again"
+
+    truncate -s 0 "$EVENTS"
+    echo "new data" >> "$file"
+    lfs hsm_archive "$file"
+    wait_for_event ARCHIVE_FINISH "$file"
+    grep -a "is unchanged since it was archived" "$EVENTS" &&
+        error "the new data of '$file' should not be found unchanged"
+    [[ $(get_data_version "$file") != $version ]] ||
+        error "the new data of '$file' should have been archived"
+}
+add_test archive_unchanged
+
 function test_hsm_remove()
 {
     local file="$test_dir/file"
@@ -634,11 +707,6 @@ function test_archive_release_restore_with_lov()
 {
     local file="$test_dir/file"
 
-    if ! ct_phobos --help | grep restore-lov
-    then
-        skip "Option '--restore-lov' required for this test"
-    fi
-
     create_file "$file"
     lfs migrate -c 2 -S 4096K "$file" ||
         error "Could not migrate '$file'"
@@ -665,6 +733,77 @@ function test_archive_release_restore_with_lov()
 }
 add_test archive_release_restore_with_lov
 
+function test_archive_release_restore_with_pfl()
+{
+    local file="$test_dir/file"
+    local copy="$test_dir/copy"
+
+    create_file "$file"
+    lfs migrate \
+        -E   1M -c  1 -S 256k \
+        -E 512M -c  2 -S 512k \
+        -E  -1  -c -1 -S 1024k \
+        "$file" || error "Could not migrate '$file'"
+    cp "$file" "$copy"
+
+    local oldstripe=$(lfs getstripe -cS --component-start "$file")
+
+    add_event_watch
+    start_copytool --restore-lov
+
+    lfs hsm_archive "$file"
+    wait_for_event ARCHIVE_FINISH "$file"
+
+    lfs hsm_release "$file"
+
+    lfs hsm_restore "$file"
+    wait_for_event RESTORE_FINISH "$file"
+
+    check_valid_restore "$copy" "$file"
+
+    local newstripe=$(lfs getstripe -cS --component-start "$file")
+
+    if [[ $oldstripe != $newstripe ]]
+    then
+        error "Components changed after restore: $oldstripe != $newstripe"
+    fi
+}
+add_test archive_release_restore_with_pfl
+
+function test_restore_stripe_policy()
+{
+    local small="$test_dir/small"
+    local large="$test_dir/large"
+
+    create_file "$small"
+    touch "$large"
+    dd if=/dev/urandom of="$large" bs=1M count=2
+    lfs migrate -c 1 "$small" "$large" ||
+        error "Could not migrate '$small' and '$large'"
+
+    add_event_watch
+    start_copytool --stripe-policy 1M:2
+
+    lfs hsm_archive "$small" "$large"
+    wait_for_event ARCHIVE_FINISH "$small"
+    wait_for_event ARCHIVE_FINISH "$large"
+
+    lfs hsm_release "$small" "$large"
+
+    lfs hsm_restore "$small" "$large"
+    wait_for_event RESTORE_FINISH "$small"
+    wait_for_event RESTORE_FINISH "$large"
+
+    local count=$(lfs getstripe -c "$small")
+    [[ $count == 1 ]] ||
+        error "'$small' should not be striped by the policy: $count stripes"
+
+    count=$(lfs getstripe -c "$large")
+    [[ $count == 2 ]] ||
+        error "'$large' should be striped by the policy: $count stripes"
+}
+add_test restore_stripe_policy
+
 function invalid_layout_error()
 {
     local file="$1"
@@ -1047,6 +1186,565 @@ function test_invalid_tag_hint()
 }
 add_test invalid_tag_hint
 
+function test_archive_batch()
+{
+    local files=()
+    local copy="$test_dir/copy"
+
+    for i in {0..3}
+    do
+        files+=("$test_dir/file$i")
+        create_file "${files[i]}"
+    done
+    cp "${files[0]}" "$copy"
+
+    add_event_watch
+    start_copytool --archive-batch-size 4 --archive-batch-delay 2000
+
+    lfs hsm_archive "${files[@]}"
+    for file in "${files[@]}"
+    do
+        wait_for_event ARCHIVE_FINISH "$file"
+        check_file_attrs "$file"
+    done
+
+    grep -a "archiving 4 files in a single PUT" "$EVENTS" ||
+        error "Files were not archived in a single PUT"
+
+    lfs hsm_release "${files[0]}"
+    lfs hsm_restore "${files[0]}"
+    wait_for_event RESTORE_FINISH "${files[0]}"
+
+    check_valid_restore "$copy" "${files[0]}"
+}
+add_test archive_batch
+
+function test_restore_batch()
+{
+    local files=()
+
+    for i in {0..3}
+    do
+        files+=("$test_dir/file$i")
+        create_file "${files[i]}"
+        cp "${files[i]}" "$test_dir/copy$i"
+    done
+
+    add_event_watch
+    start_copytool --restore-batch-size 4 --restore-batch-delay 2000
+
+    lfs hsm_archive "${files[@]}"
+    for file in "${files[@]}"
+    do
+        wait_for_event ARCHIVE_FINISH "$file"
+    done
+
+    lfs hsm_release "${files[@]}"
+    lfs hsm_restore "${files[@]}"
+    for i in {0..3}
+    do
+        wait_for_event RESTORE_FINISH "${files[i]}"
+        check_valid_restore "$test_dir/copy$i" "${files[i]}"
+    done
+
+    grep -a "in a batch of 4" "$EVENTS" ||
+        error "Restores were not scheduled together"
+}
+add_test restore_batch
+
+function test_remove_batch()
+{
+    local files=()
+    local oids=()
+
+    for i in {0..3}
+    do
+        files+=("$test_dir/file$i")
+        oids+=("${FSNAME}:$(create_file "${files[i]}")")
+    done
+
+    add_event_watch
+    start_copytool --remove-batch-size 4 --remove-batch-delay 2000
+
+    lfs hsm_archive "${files[@]}"
+    for file in "${files[@]}"
+    do
+        wait_for_event ARCHIVE_FINISH "$file"
+    done
+
+    lfs hsm_remove "${files[@]}"
+    for file in "${files[@]}"
+    do
+        wait_for_event REMOVE_FINISH "$file"
+    done
+
+    grep -a "removing 4 objects in a single DELETE" "$EVENTS" ||
+        error "Objects were not removed in a single DELETE"
+
+    local count=$(phobos object list "${oids[@]}" | wc -l)
+    (( count != 0 )) &&
+        error "Objects still alive after HSM Remove"
+
+    return 0
+}
+add_test remove_batch
+
+function test_cancel_queued_archive()
+{
+    local file="$test_dir/file"
+    local oid
+
+    oid="${FSNAME}:$(create_file "$file")"
+
+    add_event_watch
+    # keep the archive waiting for a batch long enough to cancel it
+    start_copytool --archive-batch-size 2 --archive-batch-delay 5000
+
+    lfs hsm_archive "$file"
+    sleep 1
+    lfs hsm_cancel "$file"
+    wait_for_event ARCHIVE_CANCEL "$file"
+
+    local count=$(phobos object list "$oid" | wc -l)
+    (( count != 0 )) &&
+        error "Object '$oid' stored after its archive was cancelled"
+
+    return 0
+}
+add_test cancel_queued_archive
+
+function test_update_interval()
+{
+    local file="$test_dir/file"
+
+    create_file "$file"
+
+    add_event_watch
+    start_copytool --update-interval 1
+
+    lfs hsm_archive "$file"
+    wait_for_event ARCHIVE_FINISH "$file"
+    wait_for_log_event "bytes transferred" "$file" \
+        "$(stat -c "%s" "$file") bytes"
+}
+add_test update_interval
+
+function test_bandwidth()
+{
+    local file="$test_dir/file"
+
+    dd if=/dev/urandom of="$file" bs=1M count=4
+
+    add_event_watch
+    start_copytool --bandwidth archive=1
+
+    local start=$(date +%s)
+
+    lfs hsm_archive "$file"
+    wait_for_event ARCHIVE_FINISH "$file"
+
+    # one second worth of data is sent right away, the rest at 1 MiB/s
+    (( $(date +%s) - start >= 2 )) ||
+        error "Archive was not throttled"
+
+    return 0
+}
+add_test bandwidth
+
+function test_restore_checksum_mismatch()
+{
+    local file="$test_dir/file"
+
+    create_file "$file"
+
+    add_event_watch
+    start_copytool
+
+    lfs hsm_archive "$file"
+    wait_for_event ARCHIVE_FINISH "$file"
+
+    [[ -n "$(get_xattr_value "$file" hsm_crc32c)" ]] ||
+        error "Checksum of '$file' not stored"
+
+    lfs hsm_release "$file"
+    setfattr -n trusted.hsm_crc32c -v 00000000 "$file"
+
+    lfs hsm_restore "$file"
+    wait_for_event RESTORE_ERROR "$file"
+}
+add_test restore_checksum_mismatch
+
+function test_compress_hint()
+{
+    local file="$test_dir/file"
+    local copy="$test_dir/copy"
+
+    # compressible data
+    yes "$file" | head -c 4M > "$file"
+    cp "$file" "$copy"
+
+    add_event_watch
+    start_copytool
+
+    lfs hsm_archive --data "compress=zstd:3" "$file"
+    wait_for_event ARCHIVE_FINISH "$file"
+
+    local oid="$(get_oid_from_path "$file")"
+
+    user_md_contains "$oid" "compression" "zstd" ||
+        invalid_file_attr "$file" "compression=zstd"
+    user_md_contains "$oid" "original_size" "$(stat -c "%s" "$file")" ||
+        invalid_file_attr "$file" "original_size"
+
+    lfs hsm_release "$file"
+
+    lfs hsm_restore "$file"
+    wait_for_event RESTORE_FINISH "$file"
+
+    check_valid_restore "$copy" "$file"
+}
+add_test compress_hint
+
+function test_sparse_file()
+{
+    local file="$test_dir/file"
+    local copy="$test_dir/copy"
+
+    truncate -s 64M "$file"
+    dd if=/dev/urandom of="$file" bs=1M count=1 seek=16 conv=notrunc
+    dd if=/dev/urandom of="$file" bs=4096 count=1 seek=10000 conv=notrunc
+    cp --sparse=always "$file" "$copy"
+
+    add_event_watch
+    start_copytool
+
+    lfs hsm_archive "$file"
+    wait_for_event ARCHIVE_FINISH "$file"
+
+    local oid="$(get_oid_from_path "$file")"
+
+    user_md_contains "$oid" "extents" "16777216+1048576" ||
+        invalid_file_attr "$file" "extents"
+    user_md_contains "$oid" "sparse_size" "67108864" ||
+        invalid_file_attr "$file" "sparse_size"
+
+    lfs hsm_release "$file"
+
+    lfs hsm_restore "$file"
+    wait_for_event RESTORE_FINISH "$file"
+
+    check_valid_restore "$copy" "$file"
+
+    (( $(stat -c "%b" "$file") * $(stat -c "%B" "$file") < 8 * 1024 * 1024 )) ||
+        error "Holes of '$file' were written on restore"
+}
+add_test sparse_file
+
+function test_split_file()
+{
+    local file="$test_dir/file"
+    local copy="$test_dir/copy"
+    local oid
+    local i
+
+    dd if=/dev/urandom of="$file" bs=1M count=10
+    echo "tail" >> "$file"
+    cp "$file" "$copy"
+
+    add_event_watch
+    start_copytool --chunk-threshold 8M --chunk-count 4
+
+    lfs hsm_archive "$file"
+    wait_for_event ARCHIVE_FINISH "$file"
+
+    oid="$(get_oid_from_path "$file")"
+
+    user_md_contains "$oid" "chunks" \
+        "0+3145728,3145728+3145728,6291456+3145728,9437184+1048581" ||
+        invalid_file_attr "$file" "chunks"
+    user_md_contains "$oid" "chunked_size" "10485765" ||
+        invalid_file_attr "$file" "chunked_size"
+
+    for i in 1 2 3; do
+        [[ $(phobos object list "$oid.chunk$i" | wc -l) == 1 ]] ||
+            error "Chunk $i of '$file' was not archived"
+    done
+
+    lfs hsm_release "$file"
+
+    lfs hsm_restore "$file"
+    wait_for_event RESTORE_FINISH "$file"
+
+    check_valid_restore "$copy" "$file"
+
+    lfs hsm_remove "$file"
+    wait_for_event REMOVE_FINISH "$file"
+
+    for i in 1 2 3; do
+        [[ $(phobos object list "$oid.chunk$i" | wc -l) == 0 ]] ||
+            error "Chunk $i of '$file' still alive after HSM Remove"
+    done
+}
+add_test split_file
+
+function test_pack_small_files()
+{
+    local files=("$test_dir/file1" "$test_dir/file2" "$test_dir/file3")
+    local container
+    local file
+    local fuid
+
+    for file in "${files[@]}"; do
+        create_file "$file"
+        cp "$file" "$file.copy"
+    done
+
+    add_event_watch
+    start_copytool --pack-threshold 1M --archive-batch-size 3 \
+        --archive-batch-delay 1000
+
+    lfs hsm_archive "${files[@]}"
+    for file in "${files[@]}"; do
+        wait_for_event ARCHIVE_FINISH "$file"
+    done
+
+    fuid=$(getfattr --only-values -n trusted.hsm_fuid "${files[0]}")
+    container=${fuid#pack@}
+    container=${container%@*}
+    [[ $fuid == pack@* && $container == *.pack.* ]] ||
+        error "'${files[0]}' should be packed, fuid is '$fuid'"
+    for file in "${files[@]:1}"; do
+        [[ $(getfattr --only-values -n trusted.hsm_fuid "$file") == \
+           "pack@$container@"* ]] ||
+            error "'$file' should be packed in '$container'"
+        [[ $(phobos object list "$(get_oid_from_path "$file")" | wc -l) == 0 ]] ||
+            error "'$file' should not have an object of its own"
+    done
+
+    user_md_contains "$container" "members" "$(fid_nobrace "${files[2]}")@" ||
+        invalid_file_attr "$container" "members"
+
+    lfs hsm_release "${files[@]}"
+
+    # a single file, then the other two from a single read of the container
+    lfs hsm_restore "${files[1]}"
+    wait_for_event RESTORE_FINISH "${files[1]}"
+    lfs hsm_restore "${files[0]}" "${files[2]}"
+    wait_for_event RESTORE_FINISH "${files[0]}"
+    wait_for_event RESTORE_FINISH "${files[2]}"
+
+    for file in "${files[@]}"; do
+        check_valid_restore "$file.copy" "$file"
+    done
+}
+add_test pack_small_files
+
+function test_pack_reclaim()
+{
+    local files=("$test_dir/file1" "$test_dir/file2")
+    local ledgers="$test_dir/ledgers"
+    local container
+    local fuid
+
+    mkdir "$ledgers"
+    create_file "${files[0]}"
+    create_file "${files[1]}"
+
+    add_event_watch
+    start_copytool --pack-threshold 1M --archive-batch-size 2 \
+        --archive-batch-delay 1000 --pack-ledger-dir "$ledgers"
+
+    lfs hsm_archive "${files[@]}"
+    wait_for_event ARCHIVE_FINISH "${files[0]}"
+    wait_for_event ARCHIVE_FINISH "${files[1]}"
+
+    fuid=$(getfattr --only-values -n trusted.hsm_fuid "${files[0]}")
+    container=${fuid#pack@}
+    container=${container%@*}
+
+    # the container is still used by the other file
+    lfs hsm_remove "${files[0]}"
+    wait_for_event REMOVE_FINISH "${files[0]}"
+    [[ $(phobos object list "$container" | wc -l) == 1 ]] ||
+        error "'$container' should be kept while a member uses it"
+    [[ -f "$ledgers/$container" ]] ||
+        error "'$container' should have a ledger"
+
+    lfs hsm_remove "${files[1]}"
+    wait_for_event REMOVE_FINISH "${files[1]}"
+    [[ $(phobos object list "$container" | wc -l) == 0 ]] ||
+        error "'$container' should be deleted once no member uses it"
+    [[ ! -e "$ledgers/$container" ]] ||
+        error "the ledger of '$container' should be deleted"
+}
+add_test pack_reclaim
+
+function test_pack_reclaim_failed_member()
+{
+    local files=("$test_dir/file1" "$test_dir/file2" "$test_dir/file3")
+    local ledgers="$test_dir/ledgers"
+    local container
+    local file
+    local fuid
+
+    mkdir "$ledgers"
+    for file in "${files[@]}"; do
+        create_file "$file"
+    done
+    # the fuid of the file cannot be set once it is packed
+    chattr +i "${files[0]}"
+
+    add_event_watch
+    start_copytool --pack-threshold 1M --archive-batch-size 3 \
+        --archive-batch-delay 1000 --pack-ledger-dir "$ledgers"
+
+    lfs hsm_archive "${files[@]}"
+    wait_for_event ARCHIVE_ERROR "${files[0]}"
+    wait_for_event ARCHIVE_FINISH "${files[1]}"
+    wait_for_event ARCHIVE_FINISH "${files[2]}"
+    chattr -i "${files[0]}"
+
+    fuid=$(getfattr --only-values -n trusted.hsm_fuid "${files[1]}")
+    container=${fuid#pack@}
+    container=${container%@*}
+
+    lfs hsm_remove "${files[1]}"
+    wait_for_event REMOVE_FINISH "${files[1]}"
+    [[ $(phobos object list "$container" | wc -l) == 1 ]] ||
+        error "'$container' should be kept while a member uses it"
+
+    # the range of the failed member was released along with its archive
+    lfs hsm_remove "${files[2]}"
+    wait_for_event REMOVE_FINISH "${files[2]}"
+    [[ $(phobos object list "$container" | wc -l) == 0 ]] ||
+        error "'$container' should be deleted once no member uses it"
+    [[ ! -e "$ledgers/$container" ]] ||
+        error "the ledger of '$container' should be deleted"
+}
+add_test pack_reclaim_failed_member
+
+function test_copy_family()
+{
+    local file="$test_dir/file"
+    local oid
+
+    create_file "$file"
+    cp "$file" "$file.copy"
+
+    add_event_watch
+    start_copytool --copy-family dir
+
+    lfs hsm_archive "$file"
+    wait_for_event ARCHIVE_FINISH "$file"
+
+    oid="$(get_oid_from_path "$file")"
+
+    user_md_contains "$oid" "copy" "$oid.copy" ||
+        invalid_file_attr "$file" "copy"
+    user_md_contains "$oid.copy" "copy_of" "$oid" ||
+        invalid_file_attr "$oid.copy" "copy_of"
+
+    lfs hsm_release "$file"
+    lfs hsm_restore "$file"
+    wait_for_event RESTORE_FINISH "$file"
+
+    check_valid_restore "$file.copy" "$file"
+
+    # without its copy, the file is restored from its own object
+    phobos delete "$oid.copy"
+    lfs hsm_release "$file"
+    lfs hsm_restore "$file"
+    wait_for_event RESTORE_FINISH "$file"
+
+    check_valid_restore "$file.copy" "$file"
+
+    lfs hsm_remove "$file"
+    wait_for_event REMOVE_FINISH "$file"
+
+    [[ $(phobos object list "$oid" | wc -l) == 0 ]] ||
+        error "'$oid' still alive after HSM Remove"
+}
+add_test copy_family
+
+function test_tier_down()
+{
+    local file="$test_dir/file"
+    local oid
+    local i
+
+    create_file "$file"
+    cp "$file" "$file.copy"
+
+    add_event_watch
+    start_copytool --copy-family dir --tier-down-age 1 \
+        --tier-down-interval 1
+
+    lfs hsm_archive "$file"
+    wait_for_event ARCHIVE_FINISH "$file"
+
+    oid="$(get_oid_from_path "$file")"
+
+    for i in {1..10}; do
+        [[ $(phobos object list "$oid.copy" | wc -l) == 0 ]] && break
+        sleep 1
+    done
+    [[ $(phobos object list "$oid.copy" | wc -l) == 0 ]] ||
+        error "'$oid.copy' should have been deleted by the tier-down"
+    [[ $(phobos object list "$oid" | wc -l) == 1 ]] ||
+        error "'$oid' should be kept by the tier-down"
+
+    lfs hsm_release "$file"
+    lfs hsm_restore "$file"
+    wait_for_event RESTORE_FINISH "$file"
+
+    check_valid_restore "$file.copy" "$file"
+}
+add_test tier_down
+
+function test_tier_down_dir()
+{
+    local file="$test_dir/file"
+    local restores="$test_dir/restores"
+    local oid
+
+    create_file "$file"
+    mkdir "$restores"
+
+    add_event_watch
+    start_copytool --copy-family dir --tier-down-dir "$restores"
+
+    lfs hsm_archive "$file"
+    wait_for_event ARCHIVE_FINISH "$file"
+
+    oid="$(get_oid_from_path "$file")"
+
+    user_md_contains "$oid.copy" "copy_day" "$(( $(date +%s) / 86400 ))" ||
+        invalid_file_attr "$oid.copy" "copy_day"
+
+    # older than the tier-down age below when restored
+    sleep 6
+    lfs hsm_release "$file"
+    lfs hsm_restore "$file"
+    wait_for_event RESTORE_FINISH "$file"
+
+    [[ -f "$restores/$oid.copy" ]] ||
+        error "the restore of '$oid.copy' should be recorded"
+
+    # the restore keeps the copy after a restart
+    kill_copytool
+    start_copytool --copy-family dir --tier-down-dir "$restores" \
+        --tier-down-age 5 --tier-down-interval 1
+    sleep 3
+    [[ $(phobos object list "$oid.copy" | wc -l) == 1 ]] ||
+        error "'$oid.copy' was restored, it should be kept"
+
+    lfs hsm_remove "$file"
+    wait_for_event REMOVE_FINISH "$file"
+    [[ ! -e "$restores/$oid.copy" ]] ||
+        error "the restore of '$oid.copy' should be forgotten"
+}
+add_test tier_down_dir
+
 run_tests
 
 exit $FAILURES
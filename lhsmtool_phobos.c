@@ -40,6 +40,7 @@
 
 #include <ctype.h>
 #include <fcntl.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -48,11 +49,11 @@
 #include <errno.h>
 #include <getopt.h>
 #include <pthread.h>
-#include <pwd.h>
 #include <time.h>
 #include <unistd.h>
 #include <utime.h>
 #include <signal.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/xattr.h>
 #include <sys/syscall.h>
@@ -66,22 +67,86 @@
 #include "pho_common.h"
 
 #include "layout.h"
+#include "checksum.h"
 #include "common.h"
+#include "compress.h"
+#include "fid_cache.h"
+#include "mdt_cache.h"
+#include "pack.h"
+#include "pump.h"
+#include "sparse.h"
+#include "throttle.h"
+#include "uid_cache.h"
+#include "workers.h"
 
 #define LL_HSM_ORIGIN_MAX_ARCHIVE (sizeof(__u32) * 8)
 #define XATTR_TRUSTED_PREFIX      "trusted."
 
 #define XATTR_TRUSTED_FUID_XATTR_DEFAULT "trusted.hsm_fuid"
+/* CRC32C of the archived data, as 8 hexadecimal digits */
+#define XATTR_TRUSTED_CRC32C "trusted.hsm_crc32c"
 
 #define HINT_HSM_FUID "hsm_fuid"
 
+#define OBJID_CACHE_SIZE 65536
+#define DIR_CACHE_SIZE 4096
+/* seconds the path of a directory is cached */
+#define DIR_CACHE_TTL 60
+/* seconds a user name is cached, and an unknown uid */
+#define UID_CACHE_TTL 600
+#define UID_CACHE_NEGATIVE_TTL 60
+
+#define DEFAULT_NB_WORKERS 16
+#define DEFAULT_BATCH_DELAY_MS 100
+#define DEFAULT_REPORT_INTERVAL 30
+#define DEFAULT_SPOOL_DIR "/var/tmp"
+#define DEFAULT_COMPRESS_THREADS 4
+#define DEFAULT_CHUNK_COUNT 4
+/* a thread transfers each chunk of a split file */
+#define MAX_CHUNK_COUNT 64
+/* the chunks of a split file start on a boundary of this many bytes */
+#define CHUNK_ALIGN (1024 * 1024)
+#define DEFAULT_TIER_DOWN_BATCH 100
+#define DEFAULT_TIER_DOWN_INTERVAL 600
+
 #define UNUSED __attribute__((unused))
 
 /* everything else is zeroed */
 struct options opt = {
-    .o_verbose         = LLAPI_MSG_INFO,
-    .o_default_family  = PHO_RSC_INVAL,
-    .o_restore_lov     = false,
+    .o_verbose          = LLAPI_MSG_INFO,
+    .o_default_family   = PHO_RSC_INVAL,
+    .o_copy_family      = PHO_RSC_INVAL,
+    .o_restore_lov      = false,
+    .o_checksum         = 1,
+    .o_nb_workers       = DEFAULT_NB_WORKERS,
+    .o_report_interval  = DEFAULT_REPORT_INTERVAL,
+    .o_spool_dir        = DEFAULT_SPOOL_DIR,
+    .o_compress_threads = DEFAULT_COMPRESS_THREADS,
+    .o_chunk_count      = DEFAULT_CHUNK_COUNT,
+    .o_tier_down_batch  = DEFAULT_TIER_DOWN_BATCH,
+    .o_tier_down_interval = DEFAULT_TIER_DOWN_INTERVAL,
+    /* restores are interactive, serve them first */
+    .o_lane_weight      = {
+        [CT_LANE_RESTORE] = 4,
+        [CT_LANE_ARCHIVE] = 2,
+        [CT_LANE_REMOVE]  = 1,
+    },
+    .o_batch_size       = {
+        [CT_LANE_RESTORE] = 1,
+        [CT_LANE_ARCHIVE] = 1,
+        [CT_LANE_REMOVE]  = 1,
+    },
+    .o_batch_delay_ms   = {
+        [CT_LANE_RESTORE] = DEFAULT_BATCH_DELAY_MS,
+        [CT_LANE_ARCHIVE] = DEFAULT_BATCH_DELAY_MS,
+        [CT_LANE_REMOVE]  = DEFAULT_BATCH_DELAY_MS,
+    },
+};
+
+static const char * const lane_names[] = {
+    [CT_LANE_RESTORE] = "restore",
+    [CT_LANE_ARCHIVE] = "archive",
+    [CT_LANE_REMOVE]  = "remove",
 };
 
 /*
@@ -99,6 +164,24 @@ static char fs_name[MAX_OBD_NAME + 1];
 static char trusted_fuid_xattr[MAXNAMLEN];
 
 static struct hsm_copytool_private *ctdata;
+static struct worker_pool workers;
+static struct worker_lane lanes[CT_LANE_COUNT];
+static pthread_t progress_thread;
+static struct throttle bandwidth;
+static struct throttle lane_bandwidth[CT_LANE_COUNT];
+/* layout of the restored files which have none in their metadata */
+static struct stripe_policy stripe_policy;
+/* MDT index of the FID sequences of the restored files */
+static struct mdt_cache mdt_cache;
+/* object id of the files recently archived or restored */
+static struct fid_cache objid_cache;
+/* path of the parent directories of the archived files */
+static struct fid_cache dir_cache;
+/* user name of the owners of the archived files */
+static struct uid_cache uid_cache;
+/* cleared once the filesystem turned out not to support fallocate */
+static _Atomic bool fallocate_supported = true;
+static pthread_t reload_thread;
 
 static inline double ct_now(void)
 {
@@ -126,17 +209,105 @@ static void usage(int rc)
             "        --daemon                 Daemon mode, run in background\n"
             "        --abort-on-error         Abort operation on major error\n"
             "    -A, --archive <#>            Archive number (repeatable)\n"
+            "        --archive-batch-size <#> Maximum number of files "
+            "archived in a single PUT\n"
+            "                                 (default: 1)\n"
+            "        --archive-batch-delay <ms>\n"
+            "                                 Time to wait for a batch to "
+            "fill up (default: %d)\n"
+            "    -b, --bandwidth <limits>     Bandwidth limits in MiB/s, "
+            "either a total or a\n"
+            "                                 list such as "
+            "total=<#>,archive=<#>,restore=<#>\n"
+            "                                 (default: unlimited)\n"
+            "        --bandwidth-file <path>  File holding the bandwidth "
+            "limits, read again\n"
+            "                                 on SIGHUP\n"
+            "        --chunk-count <#>        Number of objects the files "
+            "of at least the chunk\n"
+            "                                 threshold are split into "
+            "(default: %d)\n"
+            "        --chunk-threshold <size> Size from which files are "
+            "split into objects\n"
+            "                                 transferred in parallel "
+            "(default: never)\n"
+            "        --compress-threads <#>   Number of threads compressing "
+            "each file archived\n"
+            "                                 with the 'compress' hint "
+            "(default: %d)\n"
+            "        --copy-family <name>     Family of a second copy of "
+            "the archived files,\n"
+            "                                 read first by restores "
+            "(default: none)\n"
             "        --dry-run                Don't run, just show what would be done\n"
             "    -f, --event-fifo <path>      Write events stream to fifo\n"
             "    -F, --default-family <name>  Set the default family\n"
+            "        --no-checksum            Don't checksum archived data "
+            "nor verify restored data\n"
+            "        --pack-ledger-dir <path> Directory recording the "
+            "removed members of the\n"
+            "                                 containers, to delete them "
+            "(default: none)\n"
+            "        --pack-threshold <size>  Size under which the files "
+            "of an archive batch are\n"
+            "                                 packed into a single object "
+            "(default: never)\n"
             "    -q, --quiet                  Produce less verbose output\n"
+            "        --spool-dir <path>       Directory of the temporary "
+            "copies of compressed\n"
+            "                                 files (default: %s)\n"
+            "        --remove-batch-size <#>  Maximum number of objects "
+            "removed in a single DELETE\n"
+            "                                 (default: 1)\n"
+            "        --remove-batch-delay <ms>\n"
+            "                                 Time to wait for a batch to "
+            "fill up (default: %d)\n"
+            "        --restore-batch-size <#> Maximum number of restores "
+            "scheduled together\n"
+            "                                 (default: 1)\n"
+            "        --restore-batch-delay <ms>\n"
+            "                                 Time to wait for a batch to "
+            "fill up (default: %d)\n"
+            "    -u, --update-interval <s>    Interval between progress "
+            "reports (default: %d)\n"
             "    -x, --fuid-xattr             Change value of xattr for restore\n"
             "    -v, --verbose                Produce more verbose output\n"
-#ifdef HAVE_LLAPI_LAYOUT_SET_BY_FD
+            "    -w, --workers <#>            Number of actions processed "
+            "concurrently (default: %d)\n"
+            "        --max-archive <#>        Maximum number of concurrent "
+            "archives\n"
+            "        --max-restore <#>        Maximum number of concurrent "
+            "restores\n"
+            "        --max-remove <#>         Maximum number of concurrent "
+            "removes\n"
+            "        --weights <list>         Share of the workers given to "
+            "each action type\n"
+            "                                 (default: "
+            "restore=4,archive=2,remove=1)\n"
             "    -l, --restore-lov            Use the striping that the file "
             "had when archived (off by default)\n"
-#endif
-        , cmd_name);
+            "        --tier-down-age <s>      Age from which the copies "
+            "of the copy family are\n"
+            "                                 deleted, counted from their "
+            "last restore if any\n"
+            "                                 (default: never)\n"
+            "        --tier-down-batch <#>    Maximum number of copies "
+            "deleted at once (default: %d)\n"
+            "        --tier-down-dir <path>   Directory recording the last "
+            "restore of the copies,\n"
+            "                                 to keep it across restarts "
+            "(default: none)\n"
+            "        --tier-down-interval <s> Interval between deletions "
+            "of copies (default: %d)\n"
+            "        --stripe-policy <rules>  Striping of the restored files "
+            "without a stored layout,\n"
+            "                                 as a list of "
+            "<min size>:<count>[:<stripe size>[:<pool>]]\n"
+        , cmd_name, DEFAULT_BATCH_DELAY_MS, DEFAULT_CHUNK_COUNT,
+        DEFAULT_COMPRESS_THREADS,
+        DEFAULT_SPOOL_DIR, DEFAULT_BATCH_DELAY_MS, DEFAULT_BATCH_DELAY_MS,
+        DEFAULT_REPORT_INTERVAL, DEFAULT_NB_WORKERS, DEFAULT_TIER_DOWN_BATCH,
+        DEFAULT_TIER_DOWN_INTERVAL);
 
     exit(rc);
 }
@@ -200,11 +371,156 @@ static int parse_archive_id(const char *archive_value, GArray *archive_ids)
     return 0;
 }
 
-#ifdef HAVE_LLAPI_LAYOUT_SET_BY_FD
-#define GETOPTS_STRING "A:b:c:f:F:hqx:vl"
-#else
-#define GETOPTS_STRING "A:b:c:f:F:hqx:v"
-#endif
+static int parse_count(const char *value, int *count)
+{
+    uint64_t result;
+    int rc;
+
+    rc = str2uint64_t(value, &result);
+    if (rc)
+        return rc;
+
+    if (result == 0 || result > INT_MAX)
+        return -ERANGE;
+
+    *count = result;
+
+    return 0;
+}
+
+static int parse_lane_weights(const char *value)
+{
+    struct hinttab weights;
+    struct buf input;
+    size_t i;
+    int rc;
+
+    input.data = (char *)value;
+    input.len = strlen(value);
+
+    rc = process_hints(&input, &weights);
+    if (rc)
+        return rc;
+
+    for (i = 0; i < weights.count; i++) {
+        int lane;
+
+        for (lane = 0; lane < CT_LANE_COUNT; lane++)
+            if (!strcmp(weights.hints[i].key, lane_names[lane]))
+                break;
+
+        if (lane == CT_LANE_COUNT) {
+            rc = -EINVAL;
+            pho_error(rc, "unknown action type '%s'", weights.hints[i].key);
+            break;
+        }
+
+        rc = parse_count(weights.hints[i].value, &opt.o_lane_weight[lane]);
+        if (rc) {
+            pho_error(rc, "invalid weight '%s' for '%s'",
+                      weights.hints[i].value, weights.hints[i].key);
+            break;
+        }
+    }
+
+    hinttab_free(&weights);
+
+    return rc;
+}
+
+/* A rate of 0 means unlimited */
+static int parse_rate(const char *value, int *rate)
+{
+    uint64_t result;
+    int rc;
+
+    rc = str2uint64_t(value, &result);
+    if (rc)
+        return rc;
+
+    if (result > INT_MAX)
+        return -ERANGE;
+
+    *rate = result;
+
+    return 0;
+}
+
+/* Either a total bandwidth or a list of limits such as "archive=100" */
+static int parse_bandwidth(const char *value, int *total, int *lane_rates)
+{
+    struct hinttab limits;
+    struct buf input;
+    size_t i;
+    int rc;
+
+    if (!strchr(value, '='))
+        return parse_rate(value, total);
+
+    input.data = (char *)value;
+    input.len = strlen(value);
+
+    rc = process_hints(&input, &limits);
+    if (rc)
+        return rc;
+
+    for (i = 0; i < limits.count; i++) {
+        const char *key = limits.hints[i].key;
+        int *rate = NULL;
+
+        if (!strcmp(key, "total"))
+            rate = total;
+        else if (!strcmp(key, lane_names[CT_LANE_ARCHIVE]))
+            rate = &lane_rates[CT_LANE_ARCHIVE];
+        else if (!strcmp(key, lane_names[CT_LANE_RESTORE]))
+            rate = &lane_rates[CT_LANE_RESTORE];
+
+        if (!rate) {
+            rc = -EINVAL;
+            pho_error(rc, "unknown bandwidth limit '%s'", key);
+            break;
+        }
+
+        rc = parse_rate(limits.hints[i].value, rate);
+        if (rc) {
+            pho_error(rc, "invalid bandwidth '%s' for '%s'",
+                      limits.hints[i].value, key);
+            break;
+        }
+    }
+
+    hinttab_free(&limits);
+
+    return rc;
+}
+
+enum {
+    OPT_ARCHIVE_BATCH_SIZE = 256,
+    OPT_ARCHIVE_BATCH_DELAY,
+    OPT_BANDWIDTH_FILE,
+    OPT_CHUNK_COUNT,
+    OPT_CHUNK_THRESHOLD,
+    OPT_COMPRESS_THREADS,
+    OPT_COPY_FAMILY,
+    OPT_MAX_ARCHIVE,
+    OPT_MAX_RESTORE,
+    OPT_MAX_REMOVE,
+    OPT_PACK_LEDGER_DIR,
+    OPT_PACK_THRESHOLD,
+    OPT_REMOVE_BATCH_SIZE,
+    OPT_REMOVE_BATCH_DELAY,
+    OPT_RESTORE_BATCH_SIZE,
+    OPT_RESTORE_BATCH_DELAY,
+    OPT_SPOOL_DIR,
+    OPT_STRIPE_POLICY,
+    OPT_TIER_DOWN_AGE,
+    OPT_TIER_DOWN_BATCH,
+    OPT_TIER_DOWN_DIR,
+    OPT_TIER_DOWN_INTERVAL,
+    OPT_WEIGHTS,
+};
+
+#define GETOPTS_STRING "A:b:c:f:F:hqu:x:vw:l"
 
 static int ct_parseopts(int argc, char * const *argv)
 {
@@ -217,8 +533,22 @@ static int ct_parseopts(int argc, char * const *argv)
             .has_arg = no_argument },
         { .val = 'A',    .name = "archive",
             .has_arg = required_argument },
+        { .val = OPT_ARCHIVE_BATCH_DELAY, .name = "archive-batch-delay",
+            .has_arg = required_argument },
+        { .val = OPT_ARCHIVE_BATCH_SIZE, .name = "archive-batch-size",
+            .has_arg = required_argument },
         { .val = 'b',    .name = "bandwidth",
             .has_arg = required_argument },
+        { .val = OPT_BANDWIDTH_FILE, .name = "bandwidth-file",
+            .has_arg = required_argument },
+        { .val = OPT_CHUNK_COUNT, .name = "chunk-count",
+            .has_arg = required_argument },
+        { .val = OPT_CHUNK_THRESHOLD, .name = "chunk-threshold",
+            .has_arg = required_argument },
+        { .val = OPT_COMPRESS_THREADS, .name = "compress-threads",
+            .has_arg = required_argument },
+        { .val = OPT_COPY_FAMILY, .name = "copy-family",
+            .has_arg = required_argument },
         { .val = 1,    .name = "daemon",
             .has_arg = no_argument,
             .flag = &opt.o_daemonize },
@@ -235,18 +565,53 @@ static int ct_parseopts(int argc, char * const *argv)
             .flag = &opt.o_dry_run },
         { .val = 'h',    .name = "help",
             .has_arg = no_argument },
+        { .val = 0,    .name = "no-checksum",
+            .has_arg = no_argument,
+            .flag = &opt.o_checksum },
+        { .val = OPT_MAX_ARCHIVE, .name = "max-archive",
+            .has_arg = required_argument },
+        { .val = OPT_MAX_REMOVE, .name = "max-remove",
+            .has_arg = required_argument },
+        { .val = OPT_MAX_RESTORE, .name = "max-restore",
+            .has_arg = required_argument },
+        { .val = OPT_PACK_LEDGER_DIR, .name = "pack-ledger-dir",
+            .has_arg = required_argument },
+        { .val = OPT_PACK_THRESHOLD, .name = "pack-threshold",
+            .has_arg = required_argument },
         { .val = 'P',    .name = "pid-file",
             .has_arg = required_argument },
-#ifdef HAVE_LLAPI_LAYOUT_SET_BY_FD
         { .val = 'l',    .name = "restore-lov",
             .has_arg = no_argument },
-#endif
         { .val = 'q',    .name = "quiet",
             .has_arg = no_argument },
+        { .val = OPT_REMOVE_BATCH_DELAY, .name = "remove-batch-delay",
+            .has_arg = required_argument },
+        { .val = OPT_REMOVE_BATCH_SIZE, .name = "remove-batch-size",
+            .has_arg = required_argument },
+        { .val = OPT_RESTORE_BATCH_DELAY, .name = "restore-batch-delay",
+            .has_arg = required_argument },
+        { .val = OPT_RESTORE_BATCH_SIZE, .name = "restore-batch-size",
+            .has_arg = required_argument },
+        { .val = OPT_SPOOL_DIR, .name = "spool-dir",
+            .has_arg = required_argument },
+        { .val = OPT_STRIPE_POLICY, .name = "stripe-policy",
+            .has_arg = required_argument },
+        { .val = OPT_TIER_DOWN_AGE, .name = "tier-down-age",
+            .has_arg = required_argument },
+        { .val = OPT_TIER_DOWN_BATCH, .name = "tier-down-batch",
+            .has_arg = required_argument },
+        { .val = OPT_TIER_DOWN_DIR, .name = "tier-down-dir",
+            .has_arg = required_argument },
+        { .val = OPT_TIER_DOWN_INTERVAL, .name = "tier-down-interval",
+            .has_arg = required_argument },
         { .val = 'u',    .name = "update-interval",
             .has_arg = required_argument },
         { .val = 'v',    .name = "verbose",
             .has_arg = no_argument },
+        { .val = OPT_WEIGHTS, .name = "weights",
+            .has_arg = required_argument },
+        { .val = 'w',    .name = "workers",
+            .has_arg = required_argument },
         { .val = 'x',    .name = "fuid-xattr",
             .has_arg = required_argument},
         { .name = NULL }
@@ -271,6 +636,105 @@ static int ct_parseopts(int argc, char * const *argv)
                 return rc;
             }
             break;
+        case 'b':
+            rc = parse_bandwidth(optarg, &opt.o_bandwidth,
+                                 opt.o_lane_bandwidth);
+            if (rc) {
+                pho_error(rc, "Invalid bandwidth '%s'", optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
+        case OPT_BANDWIDTH_FILE:
+            opt.o_bandwidth_file = optarg;
+            break;
+        case OPT_CHUNK_COUNT:
+            rc = parse_count(optarg, &opt.o_chunk_count);
+            if (!rc && opt.o_chunk_count > MAX_CHUNK_COUNT)
+                rc = -ERANGE;
+            if (rc) {
+                pho_error(rc, "Invalid number of chunks '%s', at most %d",
+                          optarg, MAX_CHUNK_COUNT);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
+        case OPT_CHUNK_THRESHOLD:
+            rc = str2size(optarg, &opt.o_chunk_threshold);
+            if (rc) {
+                pho_error(rc, "Invalid chunk threshold '%s'", optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
+        case OPT_PACK_THRESHOLD:
+            rc = str2size(optarg, &opt.o_pack_threshold);
+            if (rc) {
+                pho_error(rc, "Invalid pack threshold '%s'", optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
+        case OPT_COMPRESS_THREADS:
+            rc = parse_count(optarg, &opt.o_compress_threads);
+            if (rc) {
+                pho_error(rc, "Invalid number of compression threads '%s'",
+                          optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
+        case OPT_COPY_FAMILY:
+            opt.o_copy_family = str2rsc_family(optarg);
+            if (opt.o_copy_family == PHO_RSC_INVAL) {
+                rc = -EINVAL;
+                pho_error(rc, "Invalid copy family '%s'", optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
+        case OPT_PACK_LEDGER_DIR:
+            opt.o_pack_ledger_dir = optarg;
+            break;
+        case OPT_SPOOL_DIR:
+            opt.o_spool_dir = optarg;
+            break;
+        case OPT_STRIPE_POLICY:
+            stripe_policy_fini(&stripe_policy);
+            rc = stripe_policy_parse(optarg, &stripe_policy);
+            if (rc) {
+                pho_error(rc, "Invalid striping policy '%s'", optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
+        case OPT_TIER_DOWN_AGE:
+            rc = parse_count(optarg, &opt.o_tier_down_age);
+            if (rc) {
+                pho_error(rc, "Invalid tier-down age '%s'", optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
+        case OPT_TIER_DOWN_BATCH:
+            rc = parse_count(optarg, &opt.o_tier_down_batch);
+            if (rc) {
+                pho_error(rc, "Invalid tier-down batch size '%s'", optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
+        case OPT_TIER_DOWN_DIR:
+            opt.o_tier_down_dir = optarg;
+            break;
+        case OPT_TIER_DOWN_INTERVAL:
+            rc = parse_count(optarg, &opt.o_tier_down_interval);
+            if (rc) {
+                pho_error(rc, "Invalid tier-down interval '%s'", optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
         case 'f':
             opt.o_event_fifo = optarg;
             break;
@@ -282,20 +746,90 @@ static int ct_parseopts(int argc, char * const *argv)
             g_array_free(opt.o_archive_ids, true);
             usage(0);
             break;
-#ifdef HAVE_LLAPI_LAYOUT_SET_BY_FD
         case 'l':
             opt.o_restore_lov = true;
             break;
-#endif
         case 'q':
              opt.o_verbose--;
              break;
         case 'P':
              opt.o_pid_file = optarg;
              break;
+        case 'u':
+            rc = parse_count(optarg, &opt.o_report_interval);
+            if (rc) {
+                pho_error(rc, "Invalid update interval '%s'", optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
         case 'v':
              opt.o_verbose++;
              break;
+        case 'w':
+            rc = parse_count(optarg, &opt.o_nb_workers);
+            if (rc) {
+                pho_error(rc, "Invalid number of workers '%s'", optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
+        case OPT_MAX_ARCHIVE:
+        case OPT_MAX_RESTORE:
+        case OPT_MAX_REMOVE: {
+            enum ct_lane lane = c == OPT_MAX_ARCHIVE ? CT_LANE_ARCHIVE :
+                                c == OPT_MAX_RESTORE ? CT_LANE_RESTORE :
+                                CT_LANE_REMOVE;
+
+            rc = parse_count(optarg, &opt.o_lane_max[lane]);
+            if (rc) {
+                pho_error(rc, "Invalid maximum number of %s actions '%s'",
+                          lane_names[lane], optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
+        }
+        case OPT_ARCHIVE_BATCH_SIZE:
+        case OPT_RESTORE_BATCH_SIZE:
+        case OPT_REMOVE_BATCH_SIZE: {
+            enum ct_lane lane = c == OPT_ARCHIVE_BATCH_SIZE ? CT_LANE_ARCHIVE :
+                                c == OPT_RESTORE_BATCH_SIZE ? CT_LANE_RESTORE :
+                                CT_LANE_REMOVE;
+
+            rc = parse_count(optarg, &opt.o_batch_size[lane]);
+            if (rc) {
+                pho_error(rc, "Invalid %s batch size '%s'", lane_names[lane],
+                          optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
+        }
+        case OPT_ARCHIVE_BATCH_DELAY:
+        case OPT_RESTORE_BATCH_DELAY:
+        case OPT_REMOVE_BATCH_DELAY: {
+            enum ct_lane lane = c == OPT_ARCHIVE_BATCH_DELAY ? CT_LANE_ARCHIVE :
+                                c == OPT_RESTORE_BATCH_DELAY ? CT_LANE_RESTORE :
+                                CT_LANE_REMOVE;
+
+            rc = parse_count(optarg, &opt.o_batch_delay_ms[lane]);
+            if (rc) {
+                pho_error(rc, "Invalid %s batch delay '%s'", lane_names[lane],
+                          optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
+        }
+        case OPT_WEIGHTS:
+            rc = parse_lane_weights(optarg);
+            if (rc) {
+                pho_error(rc, "Invalid weights '%s'", optarg);
+                g_array_free(opt.o_archive_ids, true);
+                return rc;
+            }
+            break;
         case 'x':
             rc = snprintf(trusted_fuid_xattr, sizeof(trusted_fuid_xattr),
                          "%s", optarg);
@@ -338,19 +872,18 @@ static int fid2objid(const struct lu_fid *fid, char *objid)
     return sprintf(objid, "%s:"DFID_NOBRACE, fs_name, PFID(fid));
 }
 
-static int phobos_op_del(const struct lu_fid *fid, const struct buf *hints)
+/* The object to remove is given by the hsm_fuid hint if any, otherwise it is
+ * built from the FID.
+ */
+static int ct_remove_objid(const struct lu_fid *fid, const struct buf *hints,
+                           char *objid, size_t size)
 {
-    struct pho_xfer_target xtgt = {0};
-    struct pho_xfer_desc xfer = {0};
     struct hinttab hinttab;
-    const char *obj = NULL;
-    char objid[MAXNAMLEN];
     bool objset = false;
-    int rc;
+    int rc = 0;
 
     if (hints->data) {
         size_t i;
-        int rc;
 
         pho_verb("hints provided hints='%.*s', len=%lu",
                  (int)hints->len, hints->data, hints->len);
@@ -365,42 +898,77 @@ static int phobos_op_del(const struct lu_fid *fid, const struct buf *hints)
                         i, hinttab.hints[i].key, hinttab.hints[i].value);
 
             if (!strcmp(hinttab.hints[i].key, HINT_HSM_FUID)) {
-                obj = hinttab.hints[i].value;
+                if (snprintf(objid, size, "%s",
+                             hinttab.hints[i].value) >= (int)size)
+                    rc = -ENAMETOOLONG;
                 objset = true;
             }
         }
+
+        hinttab_free(&hinttab);
+        if (rc) {
+            pho_error(rc, "invalid '%s' hint", HINT_HSM_FUID);
+            return rc;
+        }
     }
 
     if (!objset) {
         rc = fid2objid(fid, objid);
         if (rc < 0) {
             pho_error(rc, "failed to build object id for "DFID, PFID(fid));
-            goto free_hints;
+            return rc;
         }
+    }
+
+    return 0;
+}
+
+/* Delete each target with its own DEL xfer, all of them in a single
+ * phobos_delete() call. \p flags are the flags of the xfers. The outcome of
+ * each target is stored in its xt_rc field.
+ */
+static int phobos_op_del(struct pho_xfer_target *targets, size_t count,
+                         enum pho_xfer_flags flags)
+{
+    struct pho_xfer_desc *xfers;
+    bool failed = false;
+    size_t i;
+    int rc;
 
-        obj = objid;
+    xfers = calloc(count, sizeof(*xfers));
+    if (!xfers) {
+        for (i = 0; i < count; i++)
+            targets[i].xt_rc = -ENOMEM;
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < count; i++) {
+        xfers[i].xd_op = PHO_XFER_OP_DEL;
+        xfers[i].xd_flags = flags;
+        xfers[i].xd_params.delete.scope = DSS_OBJ_ALIVE;
+        xfers[i].xd_ntargets = 1;
+        xfers[i].xd_targets = &targets[i];
     }
 
     /* DO THE DELETE */
-    xfer.xd_op = PHO_XFER_OP_DEL;
-    xfer.xd_params.delete.scope = DSS_OBJ_ALIVE;
-    xfer.xd_ntargets = 1;
-    xfer.xd_targets = &xtgt;
-    xtgt.xt_objid = strdup(obj);
-    if (!xtgt.xt_objid)
-        return -errno;
+    rc = phobos_delete(xfers, count);
 
-    rc = phobos_delete(&xfer, 1);
-    if (rc)
-        pho_error(rc, "Failed to delete '%s' from Phobos", obj);
+    /* a failure of some of the objects does not fail the others */
+    for (i = 0; i < count; i++)
+        if (xfers[i].xd_rc)
+            failed = true;
 
-    /* Cleanup and exit */
-    free(xtgt.xt_objid);
-    pho_xfer_desc_clean(&xfer);
+    for (i = 0; i < count; i++) {
+        targets[i].xt_rc = xfers[i].xd_rc ? : targets[i].xt_rc ? :
+                           failed ? 0 : rc;
+        if (targets[i].xt_rc)
+            pho_error(targets[i].xt_rc, "Failed to delete '%s' from Phobos",
+                      targets[i].xt_objid);
 
-free_hints:
-    if (hints->data)
-        hinttab_free(&hinttab);
+        pho_xfer_desc_clean(&xfers[i]);
+    }
+
+    free(xfers);
 
     return rc;
 }
@@ -444,30 +1012,61 @@ out_free:
     return rc;
 }
 
-static int phobos_op_put(const struct lu_fid *fid,
-                         const char *path,
-                         const int fd,
-                         const struct stat st,
-                         struct llapi_layout *layout,
-                         const struct buf *hints,
-                         char **oid)
+/* Get the path of the file open as \p fd in the namespace of the filesystem.
+ * The path of its parent directory is cached, so that archiving the files of a
+ * directory does not resolve the whole path of each of them.
+ */
+static int ct_fullpath(int fd, char *path, size_t size)
 {
-    struct pho_xfer_target xtgt = {0};
-    struct pho_xfer_desc xfer = {0};
-    struct passwd pwd_, *pwd = NULL;
-    struct pho_attrs attrs = {0};
-    struct hinttab hinttab = {0};
-    char objid[MAXNAMLEN];
-    size_t pwd_buflen;
-    char *pwd_buf;
+    char fid_str[FID_LEN];
+    char name[NAME_MAX + 1];
+    struct lu_fid parent;
+    char dir[PATH_MAX];
+    long long recno = -1;
+    const char *rel;
+    int linkno = 0;
     int rc;
 
-    rc = fid2objid(fid, objid);
-    if (rc < 0)
+    rc = llapi_fd2parent(fd, 0, &parent, name, sizeof(name));
+    if (rc)
         return rc;
 
-    /* only used for logging, not an error if allocation failed */
-    *oid = strdup(objid);
+    if (!fid_cache_lookup(&dir_cache, &parent, dir, sizeof(dir))) {
+        snprintf(fid_str, sizeof(fid_str), DFID, PFID(&parent));
+        rc = llapi_fid2path(opt.o_mnt, fid_str, dir, sizeof(dir), &recno,
+                            &linkno);
+        if (rc)
+            return rc;
+
+        fid_cache_insert(&dir_cache, &parent, dir);
+    }
+
+    /* the path is relative to the root of the filesystem, empty for it */
+    for (rel = dir; *rel == '/'; rel++)
+        ;
+
+    if (snprintf(path, size, "%s/%s%s%s", opt.o_mnt, rel, *rel ? "/" : "",
+                 name) >= (int)size)
+        return -ENAMETOOLONG;
+
+    return 0;
+}
+
+/* Fill \p xtgt so that the content of \p fd is stored in the object \p objid.
+ * On success, the attributes of \p xtgt must be freed by the caller.
+ */
+static int phobos_op_put_target(const struct lu_fid *fid,
+                                const char *path,
+                                const int fd,
+                                const struct stat *st,
+                                struct llapi_layout *layout,
+                                char *objid,
+                                struct pho_xfer_target *xtgt)
+{
+    struct pho_attrs attrs = {0};
+    char fullpath[PATH_MAX];
+    char *username;
+    int rc;
 
     pho_attr_set(&attrs, "program", "copytool");
 
@@ -476,57 +1075,141 @@ static int phobos_op_put(const struct lu_fid *fid,
                                        (void *)&attrs);
         if (rc < 0) {
             rc = -errno;
-            goto free_xfer;
+            pho_error(rc, "failed to store the layout of "DFID, PFID(fid));
+            pho_attrs_free(&attrs);
+            return rc;
         }
     }
 
-    xfer.xd_op = PHO_XFER_OP_PUT;
-    xfer.xd_flags = 0;
-    xfer.xd_ntargets = 1;
-    xfer.xd_targets = &xtgt;
-    xtgt.xt_fd = fd;
-
     /* set oid in xattr for later use */
     rc = fsetxattr(fd, trusted_fuid_xattr, objid, strlen(objid), XATTR_CREATE);
     if (rc && errno != EEXIST)
-        pho_error(rc, "failed to set '%s' to '%s'", trusted_fuid_xattr, objid);
-
-    xtgt.xt_size = st.st_size;
-
-    pwd_buflen = sysconf(_SC_GETPW_R_SIZE_MAX);
-    /* should never happen but technically allowed... */
-    if ((long)pwd_buflen < 0)
-        pwd_buflen = 1024;
-    pwd_buf = malloc(pwd_buflen);
-    while (pwd_buf) {
-        rc = getpwuid_r(st.st_uid, &pwd_, pwd_buf, pwd_buflen, &pwd);
-        if (rc < 0 && errno == ERANGE) {
-            pho_warn("pwd buflen %zd was too small, might want to tune _SC_GETPW_R_SIZE_MAX", pwd_buflen);
-            pwd_buflen *= 2;
-            free(pwd_buf);
-            pwd_buf = malloc(pwd_buflen);
-            continue;
-        }
-        /* stop on success or any other error, pwd is only set on success */
-        break;
+        pho_error(-errno, "failed to set '%s' to '%s'", trusted_fuid_xattr,
+                  objid);
+    else if (!rc)
+        fid_cache_insert(&objid_cache, fid, objid);
+
+    rc = uid_cache_get(&uid_cache, st->st_uid, &username);
+    if (rc) {
+        pho_error(rc, "failed to set username to '%s'", objid);
+    } else {
+        pho_attr_set(&attrs, "username", username);
+        /* pho_attr_set copied the value */
+        free(username);
     }
-    if (pwd == NULL)
-        pho_error(-errno, "failed to set username to '%s'", objid);
-    else
-        pho_attr_set(&attrs, "username", pwd->pw_name);
-    /* pho_attr_set copied the value */
-    free(pwd_buf);
 
-    pho_attr_set(&attrs, "fullpath", path);
+    rc = ct_fullpath(fd, fullpath, sizeof(fullpath));
+    if (rc) {
+        pho_verb("cannot resolve the path of '%s' (rc=%d)", path, rc);
+        pho_attr_set(&attrs, "fullpath", path);
+    } else {
+        pho_attr_set(&attrs, "fullpath", fullpath);
+    }
+
+    xtgt->xt_objid = objid;
+    xtgt->xt_fd = fd;
+    xtgt->xt_size = st->st_size;
+    xtgt->xt_attrs = attrs;
+
+    return 0;
+}
+
+/* Replace the data of \p xtgt by its zstd compression. Phobos needs the size
+ * of an object before storing it, so the compressed data goes to an unlinked
+ * spool file. On success, the caller must close the new xt_fd.
+ */
+static int phobos_compress_target(struct pho_xfer_target *xtgt, int level)
+{
+    uint64_t in_size;
+    uint64_t out_size;
+    char size_str[32];
+    int spool;
+    int rc;
+
+    spool = open(opt.o_spool_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (spool < 0) {
+        rc = -errno;
+        pho_error(rc, "cannot create a spool file in '%s'", opt.o_spool_dir);
+        return rc;
+    }
+
+    rc = compress_fd(xtgt->xt_fd, spool, xtgt->xt_size, level,
+                     opt.o_compress_threads, &in_size, &out_size);
+    /* the file was truncated meanwhile */
+    if (!rc && in_size != (uint64_t)xtgt->xt_size)
+        rc = -EIO;
+    if (!rc && lseek(spool, 0, SEEK_SET) < 0)
+        rc = -errno;
+    if (rc) {
+        pho_error(rc, "cannot compress '%s'", xtgt->xt_objid);
+        close(spool);
+        return rc;
+    }
+
+    pho_verb("'%s' compressed from %ju to %ju bytes", xtgt->xt_objid,
+             (uintmax_t)in_size, (uintmax_t)out_size);
+
+    snprintf(size_str, sizeof(size_str), "%zd", xtgt->xt_size);
+    pho_attr_set(&xtgt->xt_attrs, "compression", COMPRESS_ZSTD);
+    pho_attr_set(&xtgt->xt_attrs, "original_size", size_str);
+
+    xtgt->xt_fd = spool;
+    xtgt->xt_size = out_size;
+
+    return 0;
+}
+
+/* Tell whether \p hints ask for the archived data to be compressed */
+static bool phobos_hints_compress(const struct buf *hints)
+{
+    struct hinttab hinttab;
+    bool compress = false;
+    size_t i;
+
+    if (!hints->data || process_hints(hints, &hinttab))
+        return false;
+
+    for (i = 0; i < hinttab.count; i++)
+        if (!strcmp(hinttab.hints[i].key, "compress"))
+            compress = true;
+
+    hinttab_free(&hinttab);
+
+    return compress;
+}
+
+/* Store every target in a single PUT. The transfer parameters are taken from
+ * \p hints, so every target must have been archived with the same hints.
+ * \p family overrides the family of the hints unless PHO_RSC_INVAL. \p cb is
+ * called once the PUT completes. The outcome of each target is also stored in
+ * its xt_rc field.
+ *
+ * The targets which cannot be compressed fail alone: the others are stored
+ * from a copy of the targets, which is what \p cb is given.
+ */
+static int phobos_op_put(struct pho_xfer_target *targets, size_t count,
+                         const struct buf *hints, enum rsc_family family,
+                         pho_completion_cb_t cb, void *udata)
+{
+    struct pho_xfer_desc xfer = {0};
+    struct hinttab hinttab = {0};
+    size_t *spooled = NULL;
+    bool compress = false;
+    int compress_level = 0;
+    size_t nb_spooled = 0;
+    size_t i;
+    int rc = 0;
+
+    xfer.xd_op = PHO_XFER_OP_PUT;
+    xfer.xd_flags = 0;
+    xfer.xd_ntargets = count;
+    xfer.xd_targets = targets;
 
     /* Using default family (can be amended later by a hint) */
     xfer.xd_params.put.family = opt.o_default_family;
 
     /* Use content of hints to modify fields in xfer_desc */
     if (hints->data) {
-        size_t i;
-        int rc;
-
         pho_verb("hints provided hints='%.*s', len=%lu",
                  (int)hints->len, hints->data, hints->len);
         rc = process_hints(hints, &hinttab);
@@ -564,109 +1247,178 @@ static int phobos_op_put(const struct lu_fid *fid,
                     goto free_xfer;
             } else if (!strcmp(hinttab.hints[i].key, "grouping")) {
                 xfer.xd_params.put.grouping = hinttab.hints[i].value;
+            } else if (!strcmp(hinttab.hints[i].key, "compress")) {
+                rc = compress_parse(hinttab.hints[i].value, &compress_level);
+                compress = !rc;
+                if (rc)
+                    pho_warn("cannot compress with '%s' (%s), storing "
+                             "uncompressed data", hinttab.hints[i].value,
+                             strerror(-rc));
+                rc = 0;
             } else {
                 pho_warn("unknown hint '%s'",  hinttab.hints[i].key);
             }
         }
     }
 
+    if (family != PHO_RSC_INVAL)
+        xfer.xd_params.put.family = family;
+
+    if (compress) {
+        xfer.xd_targets = calloc(count, sizeof(*xfer.xd_targets));
+        spooled = calloc(count, sizeof(*spooled));
+        if (!xfer.xd_targets || !spooled) {
+            free(xfer.xd_targets);
+            xfer.xd_targets = targets;
+            rc = -ENOMEM;
+            goto free_xfer;
+        }
+
+        for (i = 0; i < count; i++) {
+            rc = phobos_compress_target(&targets[i], compress_level);
+            if (rc) {
+                targets[i].xt_rc = rc;
+                pho_attrs_free(&targets[i].xt_attrs);
+                continue;
+            }
+
+            xfer.xd_targets[nb_spooled] = targets[i];
+            spooled[nb_spooled++] = i;
+        }
+        xfer.xd_ntargets = nb_spooled;
+        rc = 0;
+    }
+
     /* Finalize xfer_desc and to the PUT operation */
-    xtgt.xt_objid = objid;
-    xtgt.xt_attrs = attrs;
     xfer.xd_params.put.overwrite = true;
-    rc = phobos_put(&xfer, 1, NULL, NULL);
+    if (xfer.xd_ntargets)
+        rc = phobos_put(&xfer, 1, cb, udata);
+
+    /* the attributes are freed with the xfer */
+    for (i = 0; i < nb_spooled; i++) {
+        close(xfer.xd_targets[i].xt_fd);
+        xfer.xd_targets[i].xt_fd = -1;
+        targets[spooled[i]] = xfer.xd_targets[i];
+        memset(&targets[spooled[i]].xt_attrs, 0,
+               sizeof(targets[spooled[i]].xt_attrs));
+    }
 
 free_xfer:
-    /* free the tags as well */
+    for (i = 0; i < count; i++) {
+        /* a failed PUT may not set the outcome of each target */
+        if (!targets[i].xt_rc)
+            targets[i].xt_rc = xfer.xd_rc ? : rc;
+
+        if (targets[i].xt_rc)
+            pho_error(targets[i].xt_rc, "Failed to write '%s' in Phobos",
+                      targets[i].xt_objid);
+    }
+
+    /* free the tags and the attributes of the targets as well */
     pho_xfer_desc_clean(&xfer);
+    if (xfer.xd_targets != targets)
+        free(xfer.xd_targets);
+    free(spooled);
     if (hints->data)
         hinttab_free(&hinttab);
 
-    if (rc)
-        pho_error(rc, "Failed to write '%s' in Phobos", objid);
-
     return rc;
 }
 
-static int phobos_op_get(const struct lu_fid *fid,
-                         char *altobjid,
-                         UNUSED const struct buf *hints,
-                         int fd)
+/* Retrieve each target with its own GET xfer, all of them in a single
+ * phobos_get() call. \p cb is called as soon as each GET completes. The
+ * outcome of each target is also stored in its xt_rc field.
+ */
+static int phobos_op_get(struct pho_xfer_target *targets, size_t count,
+                         pho_completion_cb_t cb, void *udata)
 {
-    struct pho_xfer_target xtgt = {0};
-    struct pho_xfer_desc xfer = {0};
-    char objid[MAXNAMLEN];
-    char *obj = NULL;
+    struct pho_xfer_desc *xfers;
+    size_t i;
     int rc;
 
-    /* If provided altobjid is used as objectid */
-    if (altobjid) {
-        obj = altobjid;
-    } else {
-        rc = fid2objid(fid, objid);
-        if (rc < 0)
-            return rc;
-        obj = objid;
+    xfers = calloc(count, sizeof(*xfers));
+    if (!xfers) {
+        for (i = 0; i < count; i++)
+            targets[i].xt_rc = -ENOMEM;
+        return -ENOMEM;
     }
 
-    xfer.xd_op = PHO_XFER_OP_GET;
-    xfer.xd_params.get.scope = DSS_OBJ_ALIVE;
-    xfer.xd_flags = 0;
-    xfer.xd_ntargets = 1;
-    xfer.xd_targets = &xtgt;
-    xtgt.xt_fd = fd;
-    xtgt.xt_objid = obj;
+    for (i = 0; i < count; i++) {
+        xfers[i].xd_op = PHO_XFER_OP_GET;
+        xfers[i].xd_params.get.scope = DSS_OBJ_ALIVE;
+        xfers[i].xd_flags = 0;
+        xfers[i].xd_ntargets = 1;
+        xfers[i].xd_targets = &targets[i];
+    }
 
-    rc = phobos_get(&xfer, 1, NULL, NULL);
+    rc = phobos_get(xfers, count, cb, udata);
 
-    pho_xfer_desc_clean(&xfer);
+    for (i = 0; i < count; i++) {
+        targets[i].xt_rc = xfers[i].xd_rc ? : targets[i].xt_rc ? : rc;
+        if (targets[i].xt_rc)
+            pho_error(targets[i].xt_rc, "failed to read '%s' from Phobos",
+                      targets[i].xt_objid);
 
-    if (rc)
-        pho_error(rc, "failed to read '%s' from Phobos", obj);
+        pho_xfer_desc_clean(&xfers[i]);
+    }
+
+    free(xfers);
 
     return rc;
 }
 
-static int phobos_op_getlayout(const struct lu_fid *fid,
-                               char *altobjid,
-                               UNUSED const struct buf *hints,
-                               struct llapi_layout **layout)
+/* Fetch the user metadata of the object \p objid, to be freed by the caller,
+ * and the size of its data in Phobos.
+ */
+static int phobos_op_getmd(char *objid, struct pho_attrs *attrs, ssize_t *size)
 {
     struct pho_xfer_target xtgt = {0};
     struct pho_xfer_desc xfer = {0};
-    char objid[MAXNAMLEN];
-    char *obj = NULL;
     int rc;
 
-    /* If provided altobjid is used as objectid */
-    if (altobjid)
-        obj = altobjid;
-    else {
-        rc = fid2objid(fid, objid);
-        if (rc < 0)
-            return rc;
-        obj = objid;
-    }
-
     xfer.xd_op = PHO_XFER_OP_GETMD;
     xfer.xd_params.get.scope = DSS_OBJ_ALIVE;
     xfer.xd_flags = 0;
     xfer.xd_ntargets = 1;
     xfer.xd_targets = &xtgt;
-    xtgt.xt_objid = obj;
+    xtgt.xt_objid = objid;
 
     rc = phobos_getmd(&xfer, 1, NULL, NULL);
     if (rc) {
-        pho_error(rc, "failed to get metadata of '%s' from Phobos", obj);
+        pho_error(rc, "failed to get metadata of '%s' from Phobos", objid);
         return rc;
     }
 
-    rc = layout_from_object_md(&xtgt.xt_attrs, layout);
-    if (rc)
-        return -rc;
-
+    /* keep the attributes from being freed with the xfer */
+    *attrs = xtgt.xt_attrs;
+    *size = xtgt.xt_size;
+    memset(&xtgt.xt_attrs, 0, sizeof(xtgt.xt_attrs));
     pho_xfer_desc_clean(&xfer);
 
+    return 0;
+}
+
+/* List the alive objects whose id is one of the \p n_res ids of \p res, or
+ * matches one of the regular expressions \p res if \p is_pattern, and whose
+ * user_md has the "key=value" \p md if not NULL. \p objs is freed with
+ * phobos_store_object_list_free().
+ */
+static int phobos_op_list(const char **res, int n_res, bool is_pattern,
+                          const char *md, struct object_info **objs,
+                          int *count)
+{
+    int rc;
+
+    *objs = NULL;
+    *count = 0;
+
+    rc = phobos_store_object_list(res, n_res, is_pattern, md ? &md : NULL,
+                                  md ? 1 : 0, DSS_OBJ_ALIVE, objs, count,
+                                  NULL);
+    if (rc)
+        pho_error(rc, "failed to list '%s'%s in Phobos", res[0],
+                  n_res > 1 ? " and others" : "");
+
     return rc;
 }
 
@@ -728,39 +1480,36 @@ unsigned int hexstr2bin(const char *hex, char *out)
  * Copytool functions (with ct_ prefix)
  */
 
-static int ct_get_altobjid(const struct hsm_action_item *hai,
-                           char *altobjid)
+/* Read the xattr \p name of the open file \p fd as a string */
+static int ct_fget_xattr(int fd, const char *name, char *value, size_t size)
 {
-    char xattr_buf[XATTR_SIZE_MAX + 1];
     ssize_t xattr_size;
-    int fd;
-    int rc;
 
-    fd = llapi_open_by_fid(opt.o_mnt, &hai->hai_fid, O_RDONLY);
-    if (fd < 0)
-        return -errno;
-
-    xattr_size = fgetxattr(fd, trusted_fuid_xattr, xattr_buf,
-                           XATTR_SIZE_MAX);
-    if (xattr_size < 0) {
-        rc = -errno;
-        close(fd);
-        return rc;
-    }
+    /* keep room for the trailing zero */
+    xattr_size = fgetxattr(fd, name, value, size - 1);
+    if (xattr_size < 0)
+        return errno == ERANGE ? -ENAMETOOLONG : -errno;
 
-    memcpy(altobjid, xattr_buf, xattr_size);
-    altobjid[xattr_size] = 0; /* String trailing zero */
-    close(fd);
+    value[xattr_size] = 0; /* String trailing zero */
 
     return 0;
 }
-/* FIXME the layout API doesn't provide a function to restore \p layout
- * from \p dst_fd directly. So this function does nothing at the moment.
- */
-static int ct_restore_layout(UNUSED const char *dst,
-                             UNUSED int dst_fd,
-                             UNUSED struct llapi_layout *layout)
+
+/* Get the CRC32C of the data archived from the file, if any */
+static int ct_fget_checksum(int fd, uint32_t *crc)
 {
+    char value[16];
+    char *end;
+    int rc;
+
+    rc = ct_fget_xattr(fd, XATTR_TRUSTED_CRC32C, value, sizeof(value));
+    if (rc)
+        return rc;
+
+    *crc = strtoul(value, &end, 16);
+    if (end == value || *end != '\0')
+        return -EINVAL;
+
     return 0;
 }
 
@@ -771,6 +1520,36 @@ static int ct_path_lustre(char *buf, int sz, const char *mnt,
                     dot_lustre_name, PFID(fid));
 }
 
+/* Apply \p layout to the volatile file \p dfid. The file was created with
+ * O_LOV_DELAY_CREATE, so it has no object until its layout is set or data is
+ * written to it.
+ */
+static int ct_restore_layout(const struct lu_fid *dfid, int dst_fd,
+                             struct llapi_layout *layout)
+{
+#ifdef HAVE_LLAPI_LAYOUT_SET_BY_FD
+    (void) dfid;
+
+    if (llapi_layout_set_by_fd(dst_fd, layout) < 0)
+        return -errno;
+#else
+    char path[PATH_MAX];
+    int fd;
+
+    (void) dst_fd;
+
+    /* sets the layout of the file when it exists already */
+    ct_path_lustre(path, sizeof(path), opt.o_mnt, dfid);
+    fd = llapi_layout_file_open(path, O_WRONLY, 0, layout);
+    if (fd < 0)
+        return -errno;
+
+    close(fd);
+#endif
+
+    return 0;
+}
+
 static bool ct_is_retryable(int err)
 {
     return err == -ETIMEDOUT;
@@ -855,358 +1634,3465 @@ static void hai_get_user_data(const struct hsm_action_item *hai,
     }
 }
 
-static int ct_archive(const struct hsm_action_item *hai,
-                      UNUSED const long hal_flags)
-{
-    struct hsm_copyaction_private *hcp = NULL;
-    struct llapi_layout *layout;
-    char src[PATH_MAX];
-    int hp_flags = 0;
-    struct buf hints;
-    char *oid = NULL;
-    int src_fd = -1;
-    int open_flags;
-    struct stat st;
-    int rcf = 0;
-    int rc = 0;
+/*
+ * Life cycle of an action:
+ *
+ *   QUEUED --> PREPARED --> TRANSFERRING --> DONE
+ *      |          |                           ^
+ *      +----------+---------------------------+
+ *
+ * An action is PREPARED once the HSM action is started and the file to
+ * transfer is open. It is TRANSFERRING once submitted to Phobos, and DONE once
+ * the coordinator has been notified of its outcome. Phobos calls back as soon
+ * as the xfer of an action completes, so an action is ended without waiting
+ * for the other transfers submitted with it.
+ */
+enum ct_action_state {
+    CT_ACTION_QUEUED,
+    CT_ACTION_PREPARED,
+    CT_ACTION_TRANSFERRING,
+    CT_ACTION_DONE,
+};
 
-    rc = ct_begin(&hcp, hai);
-    if (rc < 0)
-        goto fini_major;
+/* A range of a large file, stored as an object of its own so that the ranges
+ * of the file are transferred in parallel.
+ */
+struct ct_chunk {
+    struct ct_action               *cc_action;
+    struct extent                   cc_extent;
+    /* cc_extent alone, for the pump to copy that range only */
+    struct sparse_map               cc_map;
+    struct pump                     cc_pump;
+    struct pho_xfer_target          cc_target;
+    char                            cc_objid[PATH_MAX];
+    pthread_t                       cc_thread;
+    bool                            cc_threaded;
+};
 
-    /* we fill archive so:
-     * source = data FID
-     * destination = lustre FID
+/* An HSM action received from the coordinator */
+struct ct_action {
+    struct hsm_action_item         *ca_hai;
+    long                            ca_hal_flags;
+    struct buf                      ca_hints;
+    enum ct_action_state            ca_state;
+    bool                            ca_cancelled;
+    struct hsm_copyaction_private  *ca_hcp;
+    char                            ca_path[PATH_MAX];
+    char                            ca_objid[PATH_MAX];
+    int                             ca_fd;
+    ssize_t                         ca_size;
+    /* counts the bytes transferred by Phobos, if ca_pumping */
+    struct pump                     ca_pump;
+    bool                            ca_pumping;
+    double                          ca_start;
+    uint64_t                        ca_reported;     /* bytes */
+    double                          ca_reported_at;
+    /* the progress thread is using ca_hcp, the action cannot end */
+    bool                            ca_reporting;
+    /* expected CRC32C of the restored data, if ca_verify */
+    bool                            ca_verify;
+    uint32_t                        ca_crc;
+    /* the object holds zstd compressed data */
+    bool                            ca_compressed;
+    /* data regions of the file, restores only set it for sparse objects */
+    struct sparse_map               ca_map;
+    /* Lustre data version of the archived file when the archive began, 0 if
+     * unknown
+     */
+    __u64                           ca_data_version;
+    /* the archived object already holds the current data of the file */
+    bool                            ca_unchanged;
+    /* chunks of a file split into several objects, NULL otherwise. The pumps
+     * of the chunks are used instead of ca_pump.
+     */
+    struct ct_chunk                *ca_chunks;
+    size_t                          ca_nb_chunks;
+    /* number of objects of the previous archive of the file, 0 if unknown */
+    size_t                          ca_prev_chunks;
+    /* the data of the file is a range of ca_objid, a container object shared
+     * with other small files
+     */
+    bool                            ca_packed;
+    uint64_t                        ca_pack_offset;
+    uint64_t                        ca_pack_length;
+    uint32_t                        ca_pack_crc;     /* CRC32C of the range */
+    /* container of the file when it was archived previously, empty if it was
+     * not packed
      */
-    ct_path_lustre(src, sizeof(src), opt.o_mnt, &hai->hai_dfid);
+    char                            ca_prev_container[PATH_MAX];
+    /* second copy of the data in the copy family, written from the second
+     * pipe of ca_pump by ca_copy_thread. Empty ca_copy_objid if none.
+     */
+    char                            ca_copy_objid[PATH_MAX];
+    struct pho_xfer_target          ca_copy_target;
+    pthread_t                       ca_copy_thread;
+    bool                            ca_copying;
+    /* the previous archive of the file has a copy */
+    bool                            ca_prev_copy;
+    /* the restore reads the copy, ca_fallback is set if it failed to */
+    bool                            ca_from_copy;
+    bool                            ca_fallback;
+};
 
-    pho_info("archiving '%s'", src);
+/* Notify the coordinator of the outcome of an action */
+typedef int (*ct_fini_fn_t)(struct ct_action *action, int rc);
 
-    if (opt.o_dry_run) {
-        rc = 0;
-        goto fini_major;
-    }
+/* Actions transferred by the same Phobos call. Each action has one target,
+ * both arrays are in the same order.
+ */
+struct ct_batch {
+    struct ct_action       **cb_actions;
+    struct pho_xfer_target  *cb_targets;
+    size_t                   cb_count;
+    ct_fini_fn_t             cb_fini;
+};
 
-    src_fd = llapi_hsm_action_get_fd(hcp);
-    if (src_fd < 0) {
-        rc = src_fd;
-        pho_error(rc, "cannot open '%s' for read", src);
-        goto fini_major;
+static const char *ct_action_state2str(enum ct_action_state state)
+{
+    switch (state) {
+    case CT_ACTION_QUEUED:
+        return "queued";
+    case CT_ACTION_PREPARED:
+        return "prepared";
+    case CT_ACTION_TRANSFERRING:
+        return "transferring";
+    case CT_ACTION_DONE:
+        return "done";
     }
 
-    open_flags = O_WRONLY | O_NOFOLLOW;
-    /* If extent is specified, don't truncate an old archived copy */
-    open_flags |= O_CREAT | ((hai->hai_extent.length == (unsigned long long)-1)
-                              ? O_TRUNC : 0);
+    return "unknown";
+}
 
-    layout = llapi_layout_get_by_fd(src_fd, 0);
-    if (!layout)
-        pho_error(-errno, "cannot read layout of '%s'", src);
+/* In-flight actions by cookie, so that HSMA_CANCEL can find them. The lock
+ * also protects the state and the cancellation flag of the actions.
+ */
+static GHashTable *inflight;
+static pthread_mutex_t inflight_lock = PTHREAD_MUTEX_INITIALIZER;
+/* signalled when the progress thread is done with the actions it reported */
+static pthread_cond_t reported_cond = PTHREAD_COND_INITIALIZER;
 
-    hai_get_user_data(hai, &hints);
+static void ct_action_set_state_locked(struct ct_action *action,
+                                       enum ct_action_state state)
+{
+    pho_debug("'"DFID"' action %s: %s -> %s",
+              PFID(&action->ca_hai->hai_fid),
+              hsm_copytool_action2name(action->ca_hai->hai_action),
+              ct_action_state2str(action->ca_state),
+              ct_action_state2str(state));
+    action->ca_state = state;
+}
 
-    if (fstat(src_fd, &st) < 0) {
-        rc = -errno;
-        pho_error(rc, "cannot stat '%s'", src);
-        goto fini_major;
-    }
+static void ct_action_set_state(struct ct_action *action,
+                                enum ct_action_state state)
+{
+    pthread_mutex_lock(&inflight_lock);
+    ct_action_set_state_locked(action, state);
+    pthread_mutex_unlock(&inflight_lock);
+}
 
-    /* Do phobos xfer */
-    rc = phobos_op_put(&hai->hai_fid, src, src_fd, st, layout, &hints, &oid);
-    llapi_layout_free(layout);
-    pho_info("phobos_put (archive): fid='"DFID"', size=%lu, rc=%d: %s",
-             PFID(&hai->hai_fid), st.st_size, rc, strerror(-rc));
-    if (rc)
-        goto fini_major;
-    /** @todo make clear rc management */
+/* Hand the action over to Phobos, unless it was cancelled meanwhile */
+static bool ct_action_start(struct ct_action *action)
+{
+    bool cancelled;
 
-    if (!rc)
-        goto out;
+    pthread_mutex_lock(&inflight_lock);
+    cancelled = action->ca_cancelled;
+    if (!cancelled)
+        ct_action_set_state_locked(action, CT_ACTION_TRANSFERRING);
+    pthread_mutex_unlock(&inflight_lock);
 
-fini_major:
-    err_major++;
+    return !cancelled;
+}
 
-    if (ct_is_retryable(rc))
-        hp_flags |= HP_FLAG_RETRY;
+/* Give Phobos a pipe instead of the Lustre file, so that the bytes it
+ * transfers can be counted. Without a pump, Phobos uses the file directly,
+ * outside of the bandwidth limits.
+ */
+static int ct_action_pump(struct ct_action *action,
+                          struct pho_xfer_target *xtgt, bool to_file,
+                          const struct sparse_map *map,
+                          struct throttle *throttle, unsigned int flags)
+{
+    int rc;
 
-out:
-    if (!(src_fd < 0))
-        close(src_fd);
+    rc = pump_start(&action->ca_pump, action->ca_fd, to_file, map, throttle,
+                    flags);
+    if (rc) {
+        pho_warn("cannot count the bytes transferred for '"DFID"': %s",
+                 PFID(&action->ca_hai->hai_fid), strerror(-rc));
+        if (throttle)
+            pho_warn("'"DFID"' is transferred without bandwidth limit",
+                     PFID(&action->ca_hai->hai_fid));
+        return rc;
+    }
 
-    rcf = rc;
-    rc = ct_fini(&hcp, hai, hp_flags, rcf);
-    if (rc && !rcf) {
-        int rc2;
+    xtgt->xt_fd = pump_fd(&action->ca_pump);
 
-        pho_error(rc, "failed to end ARCHIVE action, deleting '%s' from phobos",
-                  oid);
-        rc2 = phobos_op_del(&hai->hai_fid, &hints);
-        if (rc2)
-            pho_error(rc2, "Failed to remove '%s'", oid);
-    }
-    free(oid);
+    pthread_mutex_lock(&inflight_lock);
+    action->ca_pumping = true;
+    action->ca_start = action->ca_reported_at = ct_now();
+    pthread_mutex_unlock(&inflight_lock);
 
-    return rc;
+    return 0;
 }
 
-static int get_file_layout(const struct hsm_action_item *hai,
-                           const struct buf *hints, int *open_flags,
-                           struct llapi_layout **layout)
+/* Give each chunk of the action a pipe of its own, so that the chunks are
+ * transferred in parallel.
+ */
+static int ct_action_pump_chunks(struct ct_action *action, bool to_file,
+                                 struct throttle *throttle, unsigned int flags)
 {
+    size_t i;
     int rc;
 
-    rc = phobos_op_getlayout(&hai->hai_fid, NULL, hints, layout);
+    for (i = 0; i < action->ca_nb_chunks; i++) {
+        struct ct_chunk *chunk = &action->ca_chunks[i];
+
+        rc = pump_start(&chunk->cc_pump, action->ca_fd, to_file,
+                        &chunk->cc_map, throttle, flags);
+        if (rc) {
+            pho_error(rc, "cannot transfer the chunks of '"DFID"'",
+                      PFID(&action->ca_hai->hai_fid));
+            while (i--)
+                pump_stop(&action->ca_chunks[i].cc_pump);
+            return rc;
+        }
+
+        chunk->cc_target.xt_fd = pump_fd(&chunk->cc_pump);
+    }
 
-    *open_flags |= O_LOV_DELAY_CREATE;
+    pthread_mutex_lock(&inflight_lock);
+    action->ca_pumping = true;
+    action->ca_start = action->ca_reported_at = ct_now();
+    pthread_mutex_unlock(&inflight_lock);
 
-    return rc;
+    return 0;
 }
 
-static int ct_restore(const struct hsm_action_item *hai,
-                      UNUSED const long hal_flags,
-                      bool restore_lov)
+/* Number of bytes transferred so far, if ca_pumping */
+static uint64_t ct_action_bytes(struct ct_action *action)
 {
-    struct hsm_copyaction_private *hcp = NULL;
-    struct llapi_layout *layout = NULL;
-    char altobjid[PATH_MAX];
-    char *altobj = NULL;
-    struct lu_fid dfid;
-    char dst[PATH_MAX];
-    int open_flags = 0;
-    int mdt_index = -1;
-    int hp_flags = 0;
-    struct buf hints;
-    int dst_fd = -1;
-    struct stat st;
-    int rc;
+    uint64_t bytes = 0;
+    size_t i;
 
-    /*
-     * we fill lustre so:
-     * source = lustre FID in the backend
-     * destination = data FID = volatile file
-     */
+    if (!action->ca_chunks)
+        return pump_bytes(&action->ca_pump);
 
-    /* build backend file name from released file FID */
-    rc = llapi_get_mdt_index_by_fid(opt.o_mnt_fd, &hai->hai_fid,
-                                    &mdt_index);
-    if (rc < 0) {
-        pho_error(rc, "cannot get mdt index "DFID"",
-                  PFID(&hai->hai_fid));
-        return rc;
-    }
+    for (i = 0; i < action->ca_nb_chunks; i++)
+        bytes += pump_bytes(&action->ca_chunks[i].cc_pump);
 
-    hai_get_user_data(hai, &hints);
+    return bytes;
+}
 
-    if (restore_lov) {
-        rc = get_file_layout(hai, &hints, &open_flags, &layout);
-        if (rc < 0) {
-            pho_warn("Could not get file layout for "DFID", will proceed with "
-                     "default striping.", PFID(&hai->hai_fid));
-            /* use the default layout if not found in user metadata */
-            restore_lov = false;
-        }
+/* Get the CRC32C of the data transferred, false if it was not computed */
+static bool ct_action_crc(struct ct_action *action, uint32_t *crc)
+{
+    const struct ct_chunk *chunks = action->ca_chunks;
+    size_t i;
+
+    /* checksummed as they are copied to or from their container */
+    if (action->ca_packed) {
+        *crc = action->ca_pack_crc;
+        return opt.o_checksum;
     }
 
-    /* start the restore operation */
-    rc = ct_begin_restore(&hcp, hai, mdt_index, open_flags);
-    if (rc < 0)
-        goto fini;
+    if (!action->ca_pumping)
+        return false;
 
-    /* get the FID of the volatile file */
-    rc = llapi_hsm_action_get_dfid(hcp, &dfid);
-    if (rc < 0) {
-        pho_error(rc, "restoring " DFID ", "
-                      "cannot get FID of created volatile file",
-                  PFID(&hai->hai_fid));
-        goto fini;
+    if (!chunks) {
+        *crc = action->ca_pump.p_crc;
+        return action->ca_pump.p_flags & PUMP_CHECKSUM;
     }
 
-    snprintf(dst, sizeof(dst), DFID, PFID(&dfid));
+    /* the chunks are contiguous, in order */
+    *crc = chunks[0].cc_pump.p_crc;
+    for (i = 1; i < action->ca_nb_chunks; i++)
+        *crc = crc32c_combine(*crc, chunks[i].cc_pump.p_crc,
+                              chunks[i].cc_extent.e_length);
 
-    pho_info("restoring data from '" DFID "' to '%s'",
-             PFID(&hai->hai_fid), dst);
+    return chunks[0].cc_pump.p_flags & PUMP_CHECKSUM;
+}
 
-    if (opt.o_dry_run) {
+static int ct_action_unpump(struct ct_action *action)
+{
+    double elapsed = ct_now() - action->ca_start;
+    uint64_t bytes;
+    size_t i;
+    int rc;
+
+    if (!action->ca_chunks) {
+        rc = pump_stop(&action->ca_pump);
+    } else {
         rc = 0;
-        goto fini;
-    }
+        for (i = 0; i < action->ca_nb_chunks; i++) {
+            int rc2 = pump_stop(&action->ca_chunks[i].cc_pump);
 
-    dst_fd = llapi_hsm_action_get_fd(hcp);
-    if (dst_fd < 0) {
-        rc = dst_fd;
-        pho_error(rc, "cannot open '%s' for write", dst);
-        goto fini;
+            if (rc2 && !rc)
+                rc = rc2;
+        }
     }
+    bytes = ct_action_bytes(action);
 
-    rc = ct_get_altobjid(hai, altobjid);
-    if (!rc) {
-        pho_verb("Found objid from xattr of "DFID" : %s",
-                 PFID(&hai->hai_fid), altobjid);
-        altobj = altobjid;
-    } else {
-        altobj = NULL;
-    }
+    pho_info("'"DFID"' %s: %ju bytes transferred in %.1fs (%.1f MiB/s)",
+             PFID(&action->ca_hai->hai_fid),
+             hsm_copytool_action2name(action->ca_hai->hai_action),
+             (uintmax_t)bytes, elapsed,
+             elapsed > 0 ? bytes / elapsed / (1024 * 1024) : 0.);
 
-    if (restore_lov) {
-        rc = ct_restore_layout(dst, dst_fd, layout);
+    return rc;
+}
+
+static void ct_action_complete(struct ct_action *action, ct_fini_fn_t fini,
+                               int rc)
+{
+    bool cancelled;
+    bool pumping;
+
+    pthread_mutex_lock(&inflight_lock);
+    if (action->ca_state == CT_ACTION_DONE) {
+        pthread_mutex_unlock(&inflight_lock);
+        return;
+    }
+    cancelled = action->ca_cancelled;
+    pumping = action->ca_pumping;
+    ct_action_set_state_locked(action, CT_ACTION_DONE);
+    /* fini ends ca_hcp, which the progress thread may be reporting on */
+    while (action->ca_reporting)
+        pthread_cond_wait(&reported_cond, &inflight_lock);
+    pthread_mutex_unlock(&inflight_lock);
+
+    if (pumping) {
+        int rc2 = ct_action_unpump(action);
+
+        if (rc2 && !rc)
+            rc = rc2;
+    }
+
+    /* the transfer most likely failed because it was aborted */
+    if (cancelled && rc)
+        rc = -ECANCELED;
+
+    fini(action, rc);
+}
+
+/* Make the reads or writes of Phobos on the action fd fail. The fd is
+ * replaced rather than closed so that its number cannot be reused before the
+ * action ends. A read or write already in progress is not interrupted.
+ */
+static void ct_action_abort_io(struct ct_action *action)
+{
+    /* archives read from the fd, restores write to it */
+    int flags = action->ca_hai->hai_action == HSMA_ARCHIVE ? O_WRONLY :
+                                                             O_RDONLY;
+    int fd;
+
+    if (action->ca_fd < 0)
+        return;
+
+    fd = open("/dev/null", flags | O_CLOEXEC);
+    if (fd < 0) {
+        pho_warn("cannot open '/dev/null' to abort '"DFID"' transfer: %s",
+                 PFID(&action->ca_hai->hai_fid), strerror(errno));
+        return;
+    }
+
+    if (dup2(fd, action->ca_fd) < 0)
+        pho_warn("cannot abort '"DFID"' transfer: %s",
+                 PFID(&action->ca_hai->hai_fid), strerror(errno));
+
+    close(fd);
+}
+
+/* Phobos completion callback, called once per xfer. Each GET of a restore
+ * has an xfer of its own, whereas the files of an archive batch share the
+ * xfer of the PUT: they all end once the whole PUT is done.
+ */
+static void ct_batch_xfer_done(void *udata, const struct pho_xfer_desc *xfer,
+                               int rc)
+{
+    struct ct_batch *batch = udata;
+    int i;
+
+    for (i = 0; i < xfer->xd_ntargets; i++) {
+        const struct pho_xfer_target *xtgt = &xfer->xd_targets[i];
+        size_t index;
+
+        /* the targets of the xfer may be copies of the ones of the batch */
+        for (index = 0; index < batch->cb_count; index++)
+            if (batch->cb_targets[index].xt_objid == xtgt->xt_objid)
+                break;
+        if (index == batch->cb_count)
+            continue;
+
+        ct_action_complete(batch->cb_actions[index], batch->cb_fini,
+                           xtgt->xt_rc ? : xfer->xd_rc ? : rc);
+    }
+}
+
+/* Hand the batch over to Phobos. The actions cancelled meanwhile are ended
+ * and removed from the batch.
+ */
+static void ct_batch_start(struct ct_batch *batch)
+{
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; i < batch->cb_count; i++) {
+        struct ct_action *action = batch->cb_actions[i];
+
+        if (!ct_action_start(action)) {
+            ct_action_complete(action, batch->cb_fini, -ECANCELED);
+            pho_attrs_free(&batch->cb_targets[i].xt_attrs);
+            continue;
+        }
+
+        batch->cb_actions[count] = action;
+        batch->cb_targets[count++] = batch->cb_targets[i];
+    }
+
+    batch->cb_count = count;
+}
+
+/* End the actions Phobos did not call back for */
+static void ct_batch_end(struct ct_batch *batch)
+{
+    size_t i;
+
+    for (i = 0; i < batch->cb_count; i++)
+        ct_action_complete(batch->cb_actions[i], batch->cb_fini,
+                           batch->cb_targets[i].xt_rc);
+}
+
+/* The first chunk of a split file is stored in the object of the file, the
+ * others in objects named after it.
+ */
+static int ct_chunk_objid(const char *objid, size_t index, char *buf,
+                          size_t size)
+{
+    int rc;
+
+    if (index == 0)
+        rc = snprintf(buf, size, "%s", objid);
+    else
+        rc = snprintf(buf, size, "%s.chunk%zu", objid, index);
+
+    return rc >= (int)size ? -ENAMETOOLONG : 0;
+}
+
+/* Number of objects a file was split into, from the metadata of its object */
+static size_t ct_chunk_count(struct pho_attrs *attrs)
+{
+    const char *chunks = pho_attr_get(attrs, "chunks");
+    size_t count = 1;
+
+    for (; chunks && *chunks; chunks++)
+        if (*chunks == ',')
+            count++;
+
+    return count;
+}
+
+/* Set up a chunk of the action for each range of \p ranges */
+static int ct_chunks_init(struct ct_action *action,
+                          const struct sparse_map *ranges)
+{
+    size_t i;
+    int rc;
+
+    action->ca_chunks = calloc(ranges->sm_count, sizeof(*action->ca_chunks));
+    if (!action->ca_chunks)
+        return -ENOMEM;
+
+    for (i = 0; i < ranges->sm_count; i++) {
+        struct ct_chunk *chunk = &action->ca_chunks[i];
+
+        rc = ct_chunk_objid(action->ca_objid, i, chunk->cc_objid,
+                            sizeof(chunk->cc_objid));
+        if (rc) {
+            free(action->ca_chunks);
+            action->ca_chunks = NULL;
+            return rc;
+        }
+
+        chunk->cc_action = action;
+        chunk->cc_extent = ranges->sm_extents[i];
+        chunk->cc_map.sm_size = ranges->sm_size;
+        chunk->cc_map.sm_count = 1;
+        chunk->cc_map.sm_extents = &chunk->cc_extent;
+        chunk->cc_target.xt_objid = chunk->cc_objid;
+        chunk->cc_target.xt_fd = -1;
+        chunk->cc_target.xt_size = chunk->cc_extent.e_length;
+    }
+
+    action->ca_nb_chunks = ranges->sm_count;
+
+    return 0;
+}
+
+/* Transfer the chunks of the action in parallel, \p fn transferring one of
+ * them. Return the outcome of the first chunk which failed.
+ */
+static int ct_chunks_transfer(struct ct_action *action, void *(*fn)(void *))
+{
+    size_t i;
+    int rc = 0;
+
+    pho_verb("transferring '"DFID"' as %zu chunks",
+             PFID(&action->ca_hai->hai_fid), action->ca_nb_chunks);
+
+    for (i = 0; i < action->ca_nb_chunks; i++) {
+        struct ct_chunk *chunk = &action->ca_chunks[i];
+
+        chunk->cc_threaded = !pthread_create(&chunk->cc_thread, NULL, fn,
+                                             chunk);
+        /* each chunk has a pipe of its own, they can be transferred in turn */
+        if (!chunk->cc_threaded)
+            fn(chunk);
+    }
+
+    for (i = 0; i < action->ca_nb_chunks; i++) {
+        struct ct_chunk *chunk = &action->ca_chunks[i];
+
+        if (chunk->cc_threaded)
+            pthread_join(chunk->cc_thread, NULL);
+
+        if (!rc)
+            rc = chunk->cc_target.xt_rc;
+    }
+
+    return rc;
+}
+
+/* Delete the objects of the chunks \p from to \p to - 1 of \p objid */
+static void ct_chunks_delete(const char *objid, size_t from, size_t to)
+{
+    struct pho_xfer_target *targets;
+    char (*objids)[PATH_MAX];
+    size_t count = 0;
+    size_t i;
+
+    if (from >= to)
+        return;
+
+    targets = calloc(to - from, sizeof(*targets));
+    objids = calloc(to - from, sizeof(*objids));
+    if (!targets || !objids) {
+        pho_error(-ENOMEM, "cannot delete the chunks of '%s'", objid);
+        goto free_targets;
+    }
+
+    for (i = from; i < to; i++) {
+        if (ct_chunk_objid(objid, i, objids[count], sizeof(*objids)))
+            continue;
+
+        targets[count].xt_objid = objids[count];
+        count++;
+    }
+
+    pho_verb("deleting chunks %zu to %zu of '%s'", from, to - 1, objid);
+    if (count)
+        phobos_op_del(targets, count, 0);
+
+free_targets:
+    free(objids);
+    free(targets);
+}
+
+/* The copy of a file in the copy family is stored in an object named after
+ * the object of the file.
+ */
+static int ct_copy_objid(const char *objid, char *buf, size_t size)
+{
+    int rc;
+
+    rc = snprintf(buf, size, "%s.copy", objid);
+
+    return rc >= (int)size ? -ENAMETOOLONG : 0;
+}
+
+/* Copies record the day they were made, so that the tier-down only lists the
+ * days old enough for their copies to be deleted
+ */
+#define COPY_DAY_KEY "copy_day"
+#define SECONDS_PER_DAY (24 * 3600)
+
+static long ct_copy_day(double when)
+{
+    return (long)(when / SECONDS_PER_DAY);
+}
+
+/* Time of the last restore of the copies restored within the tier-down age,
+ * by object id, NULL if copies are not tiered down
+ */
+static GHashTable *copy_restores;
+static pthread_mutex_t tier_down_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* With a tier-down directory, the last restore of a copy is also the
+ * modification time of the file named after it, so that it outlives the
+ * copytool and is shared with the other copytools using the directory.
+ */
+static int ct_tier_down_path(const char *objid, char *buf, size_t size)
+{
+    int rc;
+
+    if (strchr(objid, '/'))
+        return -EINVAL;
+
+    rc = snprintf(buf, size, "%s/%s", opt.o_tier_down_dir, objid);
+
+    return rc >= (int)size ? -ENAMETOOLONG : 0;
+}
+
+static void ct_copy_restore_record(const char *objid)
+{
+    char path[PATH_MAX];
+    int rc;
+    int fd;
+
+    rc = ct_tier_down_path(objid, path, sizeof(path));
+    if (rc)
+        goto out;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        rc = -errno;
+        goto out;
+    }
+
+    if (futimens(fd, NULL))
+        rc = -errno;
+    close(fd);
+
+out:
+    if (rc)
+        pho_warn("cannot record the restore of '%s' in '%s': %s", objid,
+                 opt.o_tier_down_dir, strerror(-rc));
+}
+
+/* 0 if the restore of \p objid was not recorded */
+static double ct_copy_restore_time(const char *objid)
+{
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (!opt.o_tier_down_dir ||
+        ct_tier_down_path(objid, path, sizeof(path)) || stat(path, &st))
+        return 0;
+
+    return st.st_mtim.tv_sec + 0.000000001 * st.st_mtim.tv_nsec;
+}
+
+/* A restored copy is kept for another tier-down age */
+static void ct_copy_restored(const char *objid)
+{
+    double *when;
+    char *key;
+
+    if (!copy_restores)
+        return;
+
+    if (opt.o_tier_down_dir)
+        ct_copy_restore_record(objid);
+
+    key = strdup(objid);
+    when = malloc(sizeof(*when));
+    if (!key || !when) {
+        free(key);
+        free(when);
+        return;
+    }
+    *when = ct_now();
+
+    pthread_mutex_lock(&tier_down_lock);
+    g_hash_table_replace(copy_restores, key, when);
+    pthread_mutex_unlock(&tier_down_lock);
+}
+
+/* Forget the restores of the copies among the deleted \p targets */
+static void ct_copy_forget(const struct pho_xfer_target *targets,
+                           size_t count)
+{
+    char path[PATH_MAX];
+    size_t i;
+
+    if (!copy_restores)
+        return;
+
+    for (i = 0; i < count; i++) {
+        const char *objid = targets[i].xt_objid;
+        size_t len = strlen(objid);
+
+        if (targets[i].xt_rc || len < 5 || strcmp(objid + len - 5, ".copy"))
+            continue;
+
+        pthread_mutex_lock(&tier_down_lock);
+        g_hash_table_remove(copy_restores, objid);
+        pthread_mutex_unlock(&tier_down_lock);
+
+        if (opt.o_tier_down_dir &&
+            !ct_tier_down_path(objid, path, sizeof(path)) &&
+            unlink(path) && errno != ENOENT)
+            pho_warn("cannot delete '%s': %s", path, strerror(errno));
+    }
+}
+
+/* Delete the copy of the file whose object is \p objid, unless it was
+ * already deleted by the tier-down
+ */
+static void ct_copy_delete(const char *objid)
+{
+    struct pho_xfer_target xtgt = {0};
+    struct object_info *objs;
+    char copy[PATH_MAX];
+    const char *res = copy;
+    int count;
+
+    if (ct_copy_objid(objid, copy, sizeof(copy)))
+        return;
+
+    if (!phobos_op_list(&res, 1, false, NULL, &objs, &count)) {
+        phobos_store_object_list_free(objs, count);
+        if (count == 0)
+            return;
+    }
+
+    pho_verb("deleting copy '%s'", copy);
+    xtgt.xt_objid = copy;
+    phobos_op_del(&xtgt, 1, 0);
+    ct_copy_forget(&xtgt, 1);
+}
+
+/* Record that the file \p fid no longer uses its range of \p container. Return
+ * true once none of its members uses the container, which can then be deleted.
+ * Without a ledger directory, containers are kept.
+ */
+static bool ct_pack_release(char *container, const struct lu_fid *fid)
+{
+    struct pho_attrs attrs = {0};
+    char member[FID_LEN];
+    size_t removed = 0;
+    size_t count;
+    ssize_t size;
+    int rc;
+
+    if (!opt.o_pack_ledger_dir)
+        return false;
+
+    snprintf(member, sizeof(member), DFID_NOBRACE, PFID(fid));
+    rc = pack_ledger_add(opt.o_pack_ledger_dir, container, member, &removed);
+    if (rc) {
+        pho_warn("cannot record that '"DFID"' no longer uses '%s': %s",
+                 PFID(fid), container, strerror(-rc));
+        return false;
+    }
+
+    if (phobos_op_getmd(container, &attrs, &size))
+        return false;
+
+    count = pack_index_count(pho_attr_get(&attrs, "members"));
+    pho_attrs_free(&attrs);
+
+    pho_verb("%zu of the %zu members of '%s' no longer use it", removed,
+             count, container);
+
+    return count > 0 && removed >= count;
+}
+
+/* Delete the ledgers of the containers \p targets deleted */
+static void ct_pack_drop_ledgers(const struct pho_xfer_target *targets,
+                                 size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        int rc;
+
+        if (targets[i].xt_rc)
+            continue;
+
+        rc = pack_ledger_drop(opt.o_pack_ledger_dir, targets[i].xt_objid);
+        if (rc)
+            pho_warn("cannot delete the ledger of '%s': %s",
+                     targets[i].xt_objid, strerror(-rc));
+    }
+}
+
+/* Release the range of \p fid in \p container, and delete the container
+ * once none of its members uses it
+ */
+static void ct_pack_reclaim(char *container, const struct lu_fid *fid)
+{
+    struct pho_xfer_target xtgt = {0};
+
+    if (!ct_pack_release(container, fid))
+        return;
+
+    pho_verb("deleting '%s', none of its members uses it", container);
+    xtgt.xt_objid = container;
+    phobos_op_del(&xtgt, 1, 0);
+    ct_pack_drop_ledgers(&xtgt, 1);
+}
+
+/* Only the data regions of a sparse file are stored, their offsets and
+ * lengths are recorded in the object metadata.
+ */
+static int ct_archive_map(struct ct_action *action, const struct stat *st,
+                          struct pho_xfer_target *xtgt)
+{
+    char size_str[32];
+    char *extents;
+    int rc;
+
+    /* a file without holes uses at least as many blocks as its size */
+    if ((uint64_t)st->st_blocks * 512 >= (uint64_t)st->st_size)
+        return sparse_map_dense(st->st_size, &action->ca_map);
+
+    rc = sparse_map_build(action->ca_fd, st->st_size, &action->ca_map);
+    if (rc) {
+        pho_error(rc, "cannot map the data of '%s'", action->ca_path);
+        return rc;
+    }
+
+    if (sparse_map_is_dense(&action->ca_map))
+        return 0;
+
+    rc = sparse_map2str(&action->ca_map, &extents);
+    if (rc)
+        return rc;
+
+    snprintf(size_str, sizeof(size_str), "%jd", (intmax_t)st->st_size);
+    pho_attr_set(&xtgt->xt_attrs, "extents", extents);
+    pho_attr_set(&xtgt->xt_attrs, "sparse_size", size_str);
+    free(extents);
+
+    xtgt->xt_size = sparse_map_data_size(&action->ca_map);
+    pho_verb("'%s' is sparse, archiving %zd bytes out of %s in %zu extents",
+             action->ca_path, xtgt->xt_size, size_str,
+             action->ca_map.sm_count);
+
+    return 0;
+}
+
+/* Tell whether the object of a file which was archived already holds its
+ * current data, the data version of the file being stored in the object. The
+ * number of objects the file was split into is recorded as well, for those
+ * the new archive does not overwrite to be deleted. The container of a packed
+ * file is not looked up.
+ */
+static bool ct_archive_is_unchanged(struct ct_action *action)
+{
+    struct hsm_user_state hus;
+    struct pho_attrs attrs = {0};
+    char fuid[PATH_MAX];
+    const char *value;
+    uint64_t version;
+    uint64_t offset;
+    uint64_t length;
+    bool unchanged;
+    ssize_t size;
+
+    if (llapi_hsm_state_get_fd(action->ca_fd, &hus) ||
+        !(hus.hus_states & HS_EXISTS))
+        return false;
+
+    if (!ct_fget_xattr(action->ca_fd, trusted_fuid_xattr, fuid, sizeof(fuid)) &&
+        !str2pack_ref(fuid, action->ca_prev_container,
+                      sizeof(action->ca_prev_container), &offset, &length))
+        return false;
+
+    if (phobos_op_getmd(action->ca_objid, &attrs, &size))
+        return false;
+
+    action->ca_prev_chunks = ct_chunk_count(&attrs);
+    action->ca_prev_copy = pho_attr_get(&attrs, "copy") != NULL;
+
+    /* a file flagged dirty may still hold the data which was archived, the
+     * data version tells
+     */
+    value = pho_attr_get(&attrs, "data_version");
+    unchanged = action->ca_data_version && value &&
+                (hus.hus_states & HS_ARCHIVED) &&
+                !str2uint64_t(value, &version) &&
+                version == action->ca_data_version;
+    pho_attrs_free(&attrs);
+
+    return unchanged;
+}
+
+/* Split a large file into chunks archived in parallel, each as an object of
+ * its own. The object of the file holds the first chunk and the ranges of all
+ * of them. Only dense and uncompressed files are split, so that each chunk is
+ * a plain range of the file.
+ */
+static int ct_archive_split(struct ct_action *action,
+                            struct pho_xfer_target *xtgt)
+{
+    struct sparse_map ranges;
+    char size_str[32];
+    char *chunks;
+    int rc;
+
+    if (!opt.o_chunk_threshold ||
+        action->ca_map.sm_size < opt.o_chunk_threshold)
+        return 0;
+
+    if (!sparse_map_is_dense(&action->ca_map) ||
+        phobos_hints_compress(&action->ca_hints))
+        return 0;
+
+    rc = sparse_map_split(action->ca_map.sm_size, opt.o_chunk_count,
+                          CHUNK_ALIGN, &ranges);
+    if (rc)
+        return rc;
+
+    if (ranges.sm_count < 2)
+        goto free_ranges;
+
+    rc = sparse_map2str(&ranges, &chunks);
+    if (rc)
+        goto free_ranges;
+
+    rc = ct_chunks_init(action, &ranges);
+    if (rc) {
+        pho_error(rc, "cannot split '%s' into chunks", action->ca_path);
+        free(chunks);
+        goto free_ranges;
+    }
+
+    snprintf(size_str, sizeof(size_str), "%ju", (uintmax_t)ranges.sm_size);
+    pho_attr_set(&xtgt->xt_attrs, "chunks", chunks);
+    pho_attr_set(&xtgt->xt_attrs, "chunked_size", size_str);
+    free(chunks);
+
+    pho_verb("'%s' is split into %zu chunks of %ju bytes", action->ca_path,
+             action->ca_nb_chunks,
+             (uintmax_t)action->ca_chunks[0].cc_extent.e_length);
+
+free_ranges:
+    sparse_map_fini(&ranges);
+
+    return rc;
+}
+
+/* Open the file to archive and describe it in \p xtgt.
+ * Return 1 if there is nothing to transfer.
+ */
+static int ct_archive_prepare(struct ct_action *action,
+                              struct pho_xfer_target *xtgt)
+{
+    const struct hsm_action_item *hai = action->ca_hai;
+    struct llapi_layout *layout;
+    struct stat st;
+    int rc;
+
+    rc = ct_begin(&action->ca_hcp, hai);
+    if (rc < 0)
+        return rc;
+
+    /* we fill archive so:
+     * source = data FID
+     * destination = lustre FID
+     */
+    ct_path_lustre(action->ca_path, sizeof(action->ca_path), opt.o_mnt,
+                   &hai->hai_dfid);
+
+    pho_info("archiving '%s'", action->ca_path);
+
+    if (opt.o_dry_run)
+        return 1;
+
+    action->ca_fd = llapi_hsm_action_get_fd(action->ca_hcp);
+    if (action->ca_fd < 0) {
+        rc = action->ca_fd;
+        pho_error(rc, "cannot open '%s' for read", action->ca_path);
+        return rc;
+    }
+
+    if (fstat(action->ca_fd, &st) < 0) {
+        rc = -errno;
+        pho_error(rc, "cannot stat '%s'", action->ca_path);
+        return rc;
+    }
+
+    rc = fid2objid(&hai->hai_fid, action->ca_objid);
+    if (rc < 0)
+        return rc;
+
+    /* flush the dirty pages of the clients to get the version of the data */
+    rc = llapi_get_data_version(action->ca_fd, &action->ca_data_version,
+                                LL_DV_RD_FLUSH);
+    if (rc) {
+        pho_warn("cannot get the data version of '%s' (rc=%d)",
+                 action->ca_path, rc);
+        action->ca_data_version = 0;
+    }
+
+    if (ct_archive_is_unchanged(action)) {
+        pho_info("'%s' is unchanged since it was archived to '%s'",
+                 action->ca_path, action->ca_objid);
+        action->ca_unchanged = true;
+        return 1;
+    }
+
+    layout = llapi_layout_get_by_fd(action->ca_fd, 0);
+    if (!layout)
+        pho_error(-errno, "cannot read layout of '%s'", action->ca_path);
+
+    rc = phobos_op_put_target(&hai->hai_fid, action->ca_path, action->ca_fd,
+                              &st, layout, action->ca_objid, xtgt);
+    llapi_layout_free(layout);
+    if (rc)
+        return rc;
+
+    if (action->ca_data_version) {
+        char version[24];
+
+        snprintf(version, sizeof(version), "%llu",
+                 (unsigned long long)action->ca_data_version);
+        pho_attr_set(&xtgt->xt_attrs, "data_version", version);
+    }
+
+    rc = ct_archive_map(action, &st, xtgt);
+    if (!rc)
+        rc = ct_archive_split(action, xtgt);
+    if (rc)
+        pho_attrs_free(&xtgt->xt_attrs);
+
+    return rc;
+}
+
+/* Check that the file was not modified while its data was archived */
+static int ct_archive_check_version(struct ct_action *action)
+{
+    __u64 version;
+    int rc;
+
+    if (!action->ca_data_version)
+        return 0;
+
+    rc = llapi_get_data_version(action->ca_fd, &version, LL_DV_RD_FLUSH);
+    if (rc) {
+        pho_error(rc, "cannot get the data version of '%s'", action->ca_path);
+        return rc;
+    }
+
+    if (version != action->ca_data_version) {
+        rc = -EBUSY;
+        pho_error(rc, "'%s' was modified while being archived, data version "
+                  "%llu != %llu", action->ca_path, (unsigned long long)version,
+                  (unsigned long long)action->ca_data_version);
+        return rc;
+    }
+
+    return 0;
+}
+
+/* The copy of the file was written */
+static bool ct_archive_copied(const struct ct_action *action)
+{
+    return action->ca_copy_objid[0] && !action->ca_copy_target.xt_rc;
+}
+
+/* Delete the objects of an archive which could not be ended successfully */
+static void ct_archive_undo(struct ct_action *action)
+{
+    struct pho_xfer_target xtgt = {0};
+    size_t i;
+
+    /* the container is shared with the other files packed in it, the range
+     * of the file must still be released for the container to be reclaimed
+     */
+    if (action->ca_packed) {
+        ct_pack_reclaim(action->ca_objid, &action->ca_hai->hai_fid);
+        return;
+    }
+
+    /* only the chunks which were written */
+    for (i = 0; i < action->ca_nb_chunks; i++) {
+        struct ct_chunk *chunk = &action->ca_chunks[i];
+
+        if (chunk->cc_target.xt_rc)
+            continue;
+
+        memset(&xtgt, 0, sizeof(xtgt));
+        xtgt.xt_objid = chunk->cc_objid;
+        phobos_op_del(&xtgt, 1, 0);
+    }
+
+    if (action->ca_chunks)
+        return;
+
+    if (ct_archive_copied(action))
+        ct_copy_delete(action->ca_objid);
+
+    xtgt.xt_objid = action->ca_objid;
+    phobos_op_del(&xtgt, 1, 0);
+    if (xtgt.xt_rc)
+        pho_error(xtgt.xt_rc, "Failed to remove '%s'", action->ca_objid);
+}
+
+/* Record the CRC32C of the data read by Phobos for the restore to verify it.
+ * A checksum of a previous archive must not be left behind.
+ */
+static void ct_archive_set_checksum(struct ct_action *action)
+{
+    char value[16];
+    uint32_t crc;
+    int rc;
+
+    if (!ct_action_crc(action, &crc)) {
+        if (fremovexattr(action->ca_fd, XATTR_TRUSTED_CRC32C) &&
+            errno != ENODATA)
+            pho_warn("cannot remove '%s' of '"DFID"': %s",
+                     XATTR_TRUSTED_CRC32C, PFID(&action->ca_hai->hai_fid),
+                     strerror(errno));
+        return;
+    }
+
+    snprintf(value, sizeof(value), "%08x", crc);
+    rc = fsetxattr(action->ca_fd, XATTR_TRUSTED_CRC32C, value, strlen(value),
+                   0);
+    if (rc)
+        pho_warn("cannot set '%s' of '"DFID"' to '%s': %s",
+                 XATTR_TRUSTED_CRC32C, PFID(&action->ca_hai->hai_fid), value,
+                 strerror(errno));
+    else
+        pho_verb("'"DFID"' data checksum: crc32c=%s",
+                 PFID(&action->ca_hai->hai_fid), value);
+}
+
+/* Point a packed file at its range of the container, or a file which was
+ * packed previously back at its own object. The object id of the other files
+ * is set when their archive begins.
+ */
+static int ct_archive_set_fuid(struct ct_action *action)
+{
+    const struct lu_fid *fid = &action->ca_hai->hai_fid;
+    char fuid[PATH_MAX];
+    int rc;
+
+    if (!action->ca_packed && !action->ca_prev_container[0])
+        return 0;
+
+    if (action->ca_packed) {
+        rc = pack_ref2str(action->ca_objid, action->ca_pack_offset,
+                          action->ca_pack_length, fuid, sizeof(fuid));
+        if (rc) {
+            pho_error(rc, "cannot refer to the data of '"DFID"' in '%s'",
+                      PFID(fid), action->ca_objid);
+            return rc;
+        }
+    } else {
+        snprintf(fuid, sizeof(fuid), "%s", action->ca_objid);
+    }
+
+    if (fsetxattr(action->ca_fd, trusted_fuid_xattr, fuid, strlen(fuid), 0)) {
+        rc = -errno;
+        pho_error(rc, "failed to set '%s' to '%s'", trusted_fuid_xattr, fuid);
+        fid_cache_invalidate(&objid_cache, fid);
+        return rc;
+    }
+
+    fid_cache_insert(&objid_cache, fid, fuid);
+
+    return 0;
+}
+
+/* Delete the objects of the previous archive which were not overwritten */
+static void ct_archive_drop_previous(struct ct_action *action)
+{
+    char objid[PATH_MAX];
+
+    /* the range of the file in its previous container is now unused */
+    if (action->ca_prev_container[0])
+        ct_pack_reclaim(action->ca_prev_container, &action->ca_hai->hai_fid);
+
+    if (!action->ca_packed) {
+        ct_chunks_delete(action->ca_objid,
+                         action->ca_chunks ? action->ca_nb_chunks : 1,
+                         action->ca_prev_chunks);
+        /* the previous copy holds stale data unless overwritten */
+        if (action->ca_prev_copy && !ct_archive_copied(action))
+            ct_copy_delete(action->ca_objid);
+        return;
+    }
+
+    /* the object of the file itself, now that it is packed */
+    if (action->ca_prev_chunks &&
+        fid2objid(&action->ca_hai->hai_fid, objid) >= 0) {
+        ct_chunks_delete(objid, 0, action->ca_prev_chunks);
+        if (action->ca_prev_copy)
+            ct_copy_delete(objid);
+    }
+}
+
+static int ct_archive_fini(struct ct_action *action, int rc)
+{
+    const struct hsm_action_item *hai = action->ca_hai;
+    int hp_flags = 0;
+    int rcf;
+
+    /* the object was written, but it is no longer wanted */
+    if (!rc && action->ca_cancelled && action->ca_fd >= 0 &&
+        !action->ca_unchanged) {
+        pho_info("archive of '"DFID"' cancelled, deleting '%s' from phobos",
+                 PFID(&hai->hai_fid), action->ca_objid);
+        ct_archive_undo(action);
+        rc = -ECANCELED;
+    }
+
+    /* restores look the data of the file up by its fuid */
+    if (!rc && action->ca_fd >= 0 && !action->ca_unchanged) {
+        rc = ct_archive_set_fuid(action);
+        if (rc)
+            ct_archive_undo(action);
+    }
+
+    if (rc && rc != -ECANCELED) {
+        err_major++;
+
+        /* the file was modified during the archive, it can be tried again */
+        if (ct_is_retryable(rc) || rc == -EBUSY)
+            hp_flags |= HP_FLAG_RETRY;
+    }
+
+    /* the checksum of the unchanged data is already set */
+    if (!rc && action->ca_fd >= 0 && !action->ca_unchanged) {
+        ct_archive_set_checksum(action);
+        ct_archive_drop_previous(action);
+    }
+
+    if (!(action->ca_fd < 0)) {
+        close(action->ca_fd);
+        action->ca_fd = -1;
+    }
+
+    rcf = rc;
+    rc = ct_fini(&action->ca_hcp, hai, hp_flags, rcf);
+    if (rc && !rcf) {
+        pho_error(rc, "failed to end ARCHIVE action, deleting '%s' from phobos",
+                  action->ca_objid);
+        ct_archive_undo(action);
+    }
+
+    return rc;
+}
+
+/* Wait for the copy of the file to be written, if it has one */
+static void ct_archive_copy_wait(struct ct_action *action)
+{
+    if (!action->ca_copying)
+        return;
+
+    pthread_join(action->ca_copy_thread, NULL);
+    action->ca_copying = false;
+
+    if (action->ca_copy_target.xt_rc)
+        pho_warn("cannot copy '"DFID"' to '%s', it will be restored from "
+                 "'%s' (rc=%d)", PFID(&action->ca_hai->hai_fid),
+                 action->ca_copy_objid, action->ca_objid,
+                 action->ca_copy_target.xt_rc);
+    else
+        pho_verb("'"DFID"' copied to '%s'",
+                 PFID(&action->ca_hai->hai_fid), action->ca_copy_objid);
+}
+
+static int ct_archive_xfer_fini(struct ct_action *action, int rc)
+{
+    /* the pump is stopped, the copy has all of the data by now */
+    ct_archive_copy_wait(action);
+
+    pho_info("phobos_put (archive): fid='"DFID"', size=%zd, rc=%d: %s",
+             PFID(&action->ca_hai->hai_fid), action->ca_size, rc,
+             strerror(-rc));
+
+    if (!rc && !action->ca_cancelled) {
+        rc = ct_archive_check_version(action);
+        /* the object does not hold the data of any version of the file */
+        if (rc)
+            ct_archive_undo(action);
+    }
+
+    return ct_archive_fini(action, rc);
+}
+
+static void *ct_chunk_put_thread(void *data)
+{
+    struct ct_chunk *chunk = data;
+
+    phobos_op_put(&chunk->cc_target, 1, &chunk->cc_action->ca_hints,
+                  PHO_RSC_INVAL, NULL, NULL);
+
+    return NULL;
+}
+
+/* Archive the chunks of a split file with a PUT each, in parallel. \p xtgt
+ * describes the object of the file, it is used for the first chunk.
+ */
+static void ct_archive_chunks(struct ct_action *action,
+                              struct pho_xfer_target *xtgt)
+{
+    size_t i;
+    int rc;
+
+    rc = ct_action_pump_chunks(action, false,
+                               &lane_bandwidth[CT_LANE_ARCHIVE],
+                               opt.o_checksum ? PUMP_CHECKSUM : 0);
+    if (rc) {
+        ct_action_complete(action, ct_archive_fini, rc);
+        pho_attrs_free(&xtgt->xt_attrs);
+        return;
+    }
+
+    /* the attributes are freed by the PUT */
+    action->ca_chunks[0].cc_target.xt_attrs = xtgt->xt_attrs;
+    memset(&xtgt->xt_attrs, 0, sizeof(xtgt->xt_attrs));
+    for (i = 1; i < action->ca_nb_chunks; i++) {
+        struct pho_attrs *attrs = &action->ca_chunks[i].cc_target.xt_attrs;
+
+        pho_attr_set(attrs, "program", "copytool");
+        pho_attr_set(attrs, "chunk_of", action->ca_objid);
+    }
+
+    rc = ct_chunks_transfer(action, ct_chunk_put_thread);
+    /* the chunks written are of no use without the others */
+    if (rc)
+        ct_archive_undo(action);
+
+    ct_action_complete(action, ct_archive_xfer_fini, rc);
+}
+
+/* Files under the pack threshold are packed, unless sparse */
+static bool ct_archive_packable(const struct ct_action *action)
+{
+    return action->ca_map.sm_size < opt.o_pack_threshold &&
+           !action->ca_chunks && sparse_map_is_dense(&action->ca_map);
+}
+
+/* Copy the data of \p members to a spool file, one after the other, and store
+ * it with a single PUT as a container object whose metadata indexes them.
+ * Phobos needs the size of the container before storing it, hence the spool
+ * file.
+ */
+static void ct_archive_pack_members(struct ct_action **members, size_t count)
+{
+    struct pho_xfer_target xtgt = {0};
+    struct pack_member *index;
+    char objid[PATH_MAX];
+    char (*fids)[FID_LEN];
+    size_t nb_packed = 0;
+    uint64_t size = 0;
+    struct pump pump;
+    char *index_str;
+    int spool = -1;
+    size_t i;
+    int rc;
+
+    index = calloc(count, sizeof(*index));
+    fids = calloc(count, sizeof(*fids));
+    if (!index || !fids) {
+        rc = -ENOMEM;
+        goto fail_members;
+    }
+
+    /* the first member and the time make the id of the container unique */
+    snprintf(objid, sizeof(objid), "%s.pack.%ju", members[0]->ca_objid,
+             (uintmax_t)(ct_now() * 1000000));
+
+    spool = open(opt.o_spool_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (spool < 0) {
+        rc = -errno;
+        pho_error(rc, "cannot create a spool file in '%s'", opt.o_spool_dir);
+        goto fail_members;
+    }
+
+    for (i = 0; i < count; i++) {
+        struct ct_action *action = members[i];
+        uint64_t length = action->ca_map.sm_size;
+        uint32_t crc = 0;
+
+        rc = pack_copy(action->ca_fd, 0, spool, size, length,
+                       opt.o_checksum ? &crc : NULL);
+        if (rc) {
+            pho_error(rc, "cannot pack '%s' into '%s'", action->ca_path,
+                      objid);
+            ct_action_complete(action, ct_archive_fini, rc);
+            continue;
+        }
+
+        action->ca_packed = true;
+        action->ca_pack_offset = size;
+        action->ca_pack_length = length;
+        action->ca_pack_crc = crc;
+
+        snprintf(fids[nb_packed], sizeof(*fids), DFID_NOBRACE,
+                 PFID(&action->ca_hai->hai_fid));
+        index[nb_packed].pm_id = fids[nb_packed];
+        index[nb_packed].pm_offset = size;
+        index[nb_packed].pm_length = length;
+        index[nb_packed].pm_crc = crc;
+        members[nb_packed++] = action;
+        size += length;
+    }
+
+    count = nb_packed;
+    if (count == 0)
+        goto close_spool;
+
+    /* data left by a file which could not be packed entirely */
+    if (ftruncate(spool, size) < 0) {
+        rc = -errno;
+        goto fail_spool;
+    }
+
+    rc = pack_index2str(index, count, opt.o_checksum, &index_str);
+    if (rc)
+        goto fail_spool;
+
+    rc = pump_start(&pump, spool, false, NULL,
+                    &lane_bandwidth[CT_LANE_ARCHIVE], 0);
+    if (rc) {
+        free(index_str);
+        goto fail_spool;
+    }
+
+    pho_attr_set(&xtgt.xt_attrs, "program", "copytool");
+    pho_attr_set(&xtgt.xt_attrs, "members", index_str);
+    free(index_str);
+    xtgt.xt_objid = objid;
+    xtgt.xt_fd = pump_fd(&pump);
+    xtgt.xt_size = size;
+
+    pho_info("packing %zu files into '%s', %ju bytes", count, objid,
+             (uintmax_t)size);
+
+    phobos_op_put(&xtgt, 1, &members[0]->ca_hints, PHO_RSC_INVAL, NULL,
+                  NULL);
+    rc = pump_stop(&pump);
+    rc = xtgt.xt_rc ? : rc;
+
+    for (i = 0; i < count; i++) {
+        snprintf(members[i]->ca_objid, sizeof(members[i]->ca_objid), "%s",
+                 objid);
+        ct_action_complete(members[i], ct_archive_xfer_fini, rc);
+    }
+    goto close_spool;
+
+fail_spool:
+    pho_error(rc, "cannot store '%s'", objid);
+fail_members:
+    for (i = 0; i < count; i++)
+        ct_action_complete(members[i], ct_archive_fini, rc);
+close_spool:
+    if (spool >= 0)
+        close(spool);
+    free(fids);
+    free(index);
+}
+
+/* Pack the small files of the batch into a container object, the other files
+ * are left in the batch to be archived as objects of their own.
+ */
+static void ct_archive_pack(struct ct_batch *batch)
+{
+    struct ct_action **members;
+    size_t nb_members = 0;
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; i < batch->cb_count; i++)
+        if (ct_archive_packable(batch->cb_actions[i]))
+            nb_members++;
+
+    /* a container of a single file would not spare anything */
+    if (nb_members < 2)
+        return;
+
+    members = calloc(nb_members, sizeof(*members));
+    if (!members)
+        return;
+
+    nb_members = 0;
+    for (i = 0; i < batch->cb_count; i++) {
+        struct ct_action *action = batch->cb_actions[i];
+
+        if (!ct_archive_packable(action)) {
+            batch->cb_actions[count] = action;
+            batch->cb_targets[count++] = batch->cb_targets[i];
+            continue;
+        }
+
+        /* the members are only described by the index of the container */
+        pho_attrs_free(&batch->cb_targets[i].xt_attrs);
+        members[nb_members++] = action;
+    }
+    batch->cb_count = count;
+
+    ct_archive_pack_members(members, nb_members);
+    free(members);
+}
+
+static void *ct_copy_put_thread(void *data)
+{
+    struct ct_action *action = data;
+    struct pho_xfer_target *copy = &action->ca_copy_target;
+    /* the PUT replaces the fd by a spool file if compressing */
+    int fd = copy->xt_fd;
+
+    phobos_op_put(copy, 1, &action->ca_hints, opt.o_copy_family, NULL, NULL);
+    /* the pump stops copying the data it could not read */
+    close(fd);
+
+    return NULL;
+}
+
+/* Write a copy of the file to the copy family from the second pipe of its
+ * pump, so that the file is read once for both objects. Each copy has a PUT
+ * of its own, so that the copies are read in whatever order the PUT of the
+ * batch reads the objects. A copy PUT may still wait for a device held by
+ * another one, itself waiting for data the PUT of the batch holds back: the
+ * pump drops a copy which is not read for a while, rather than waiting for it.
+ */
+static void ct_archive_copy_start(struct ct_action *action,
+                                  struct pho_xfer_target *xtgt)
+{
+    struct pho_xfer_target *copy = &action->ca_copy_target;
+    char day[32];
+    int rc;
+
+    copy->xt_fd = pump_tee_fd(&action->ca_pump);
+    copy->xt_size = xtgt->xt_size;
+
+    rc = ct_copy_objid(action->ca_objid, action->ca_copy_objid,
+                       sizeof(action->ca_copy_objid));
+    if (rc)
+        goto fail;
+
+    copy->xt_objid = action->ca_copy_objid;
+    pho_attr_set(&copy->xt_attrs, "program", "copytool");
+    pho_attr_set(&copy->xt_attrs, "copy_of", action->ca_objid);
+    snprintf(day, sizeof(day), "%ld", ct_copy_day(ct_now()));
+    pho_attr_set(&copy->xt_attrs, COPY_DAY_KEY, day);
+
+    rc = -pthread_create(&action->ca_copy_thread, NULL, ct_copy_put_thread,
+                         action);
+    if (rc) {
+        pho_attrs_free(&copy->xt_attrs);
+        goto fail;
+    }
+
+    action->ca_copying = true;
+    /* restores read the copy first */
+    pho_attr_set(&xtgt->xt_attrs, "copy", action->ca_copy_objid);
+
+    return;
+
+fail:
+    pho_warn("cannot copy '"DFID"' to family '%s': %s",
+             PFID(&action->ca_hai->hai_fid),
+             rsc_family2str(opt.o_copy_family), strerror(-rc));
+    action->ca_copy_objid[0] = '\0';
+    close(copy->xt_fd);
+}
+
+/* Archive a batch of files sharing the same hints with a single PUT */
+static void ct_archive(struct ct_action **actions, size_t count)
+{
+    struct ct_batch batch = {
+        .cb_fini = ct_archive_xfer_fini,
+    };
+    size_t pumped = 0;
+    size_t i;
+    int rc;
+
+    batch.cb_targets = calloc(count, sizeof(*batch.cb_targets));
+    batch.cb_actions = calloc(count, sizeof(*batch.cb_actions));
+    if (!batch.cb_targets || !batch.cb_actions) {
+        for (i = 0; i < count; i++)
+            ct_action_complete(actions[i], ct_archive_fini, -ENOMEM);
+        goto free_batch;
+    }
+
+    for (i = 0; i < count; i++) {
+        struct pho_xfer_target *xtgt = &batch.cb_targets[batch.cb_count];
+
+        rc = ct_archive_prepare(actions[i], xtgt);
+        if (rc) {
+            /* nothing to transfer is not an error */
+            ct_action_complete(actions[i], ct_archive_fini, rc < 0 ? rc : 0);
+            continue;
+        }
+        actions[i]->ca_size = actions[i]->ca_map.sm_size;
+        ct_action_set_state(actions[i], CT_ACTION_PREPARED);
+        batch.cb_actions[batch.cb_count++] = actions[i];
+    }
+
+    ct_batch_start(&batch);
+    if (batch.cb_count == 0)
+        goto free_batch;
+
+    /* small files are packed together rather than being stored each */
+    if (opt.o_pack_threshold) {
+        ct_archive_pack(&batch);
+        if (batch.cb_count == 0)
+            goto free_batch;
+    }
+
+    if (batch.cb_count > 1)
+        pho_info("archiving %zu files in a single PUT", batch.cb_count);
+
+    for (i = 0; i < batch.cb_count; i++) {
+        struct ct_action *action = batch.cb_actions[i];
+        unsigned int flags = 0;
+
+        /* split files are archived on their own, with a PUT per chunk */
+        if (action->ca_chunks) {
+            ct_archive_chunks(action, &batch.cb_targets[i]);
+            continue;
+        }
+
+        if (opt.o_checksum)
+            flags |= PUMP_CHECKSUM;
+        if (opt.o_copy_family != PHO_RSC_INVAL)
+            flags |= PUMP_TEE;
+
+        rc = ct_action_pump(action, &batch.cb_targets[i], false,
+                            &action->ca_map, &lane_bandwidth[CT_LANE_ARCHIVE],
+                            flags);
+        /* Phobos would read the holes of the file as well, a dense file is
+         * read directly, without bandwidth limit
+         */
+        if (rc && !sparse_map_is_dense(&action->ca_map)) {
+            ct_action_complete(action, ct_archive_fini, rc);
+            pho_attrs_free(&batch.cb_targets[i].xt_attrs);
+            continue;
+        }
+
+        if (!rc && (flags & PUMP_TEE))
+            ct_archive_copy_start(action, &batch.cb_targets[i]);
+
+        batch.cb_actions[pumped] = action;
+        batch.cb_targets[pumped++] = batch.cb_targets[i];
+    }
+
+    batch.cb_count = pumped;
+    if (batch.cb_count == 0)
+        goto free_batch;
+
+    /* A single multi-target xfer, so that Phobos stores the whole batch
+     * together
+     */
+    phobos_op_put(batch.cb_targets, batch.cb_count,
+                  &batch.cb_actions[0]->ca_hints, PHO_RSC_INVAL,
+                  ct_batch_xfer_done, &batch);
+    ct_batch_end(&batch);
+
+free_batch:
+    free(batch.cb_actions);
+    free(batch.cb_targets);
+}
+
+/* Map the data of a sparse object to the holes of the file */
+static int ct_restore_map(struct ct_action *action, struct pho_attrs *attrs)
+{
+    const char *extents = pho_attr_get(attrs, "extents");
+    const char *size_str = pho_attr_get(attrs, "sparse_size");
+    uint64_t size;
+    int rc;
+
+    if (!extents)
+        return 0;
+
+    rc = size_str ? str2uint64_t(size_str, &size) : -EINVAL;
+    if (!rc)
+        rc = str2sparse_map(extents, size, &action->ca_map);
+    if (rc) {
+        pho_error(rc, "invalid extents '%s' of '%s'", extents,
+                  action->ca_objid);
+        return rc;
+    }
+
+    pho_verb("'%s' is sparse, restoring %ju bytes of data out of %ju",
+             action->ca_objid,
+             (uintmax_t)sparse_map_data_size(&action->ca_map),
+             (uintmax_t)size);
+
+    return 0;
+}
+
+/* Get the chunks of a file split into several objects */
+static int ct_restore_chunks_md(struct ct_action *action,
+                                struct pho_attrs *attrs)
+{
+    const char *size_str = pho_attr_get(attrs, "chunked_size");
+    const char *chunks = pho_attr_get(attrs, "chunks");
+    struct sparse_map ranges;
+    uint64_t size;
+    int rc;
+
+    if (!chunks)
+        return 0;
+
+    rc = size_str ? str2uint64_t(size_str, &size) : -EINVAL;
+    if (!rc)
+        rc = str2sparse_map(chunks, size, &ranges);
+    /* the chunks must cover the whole file */
+    if (!rc && sparse_map_data_size(&ranges) != size) {
+        sparse_map_fini(&ranges);
+        rc = -EINVAL;
+    }
+    if (rc) {
+        pho_error(rc, "invalid chunks '%s' of '%s'", chunks, action->ca_objid);
+        return rc;
+    }
+
+    rc = ct_chunks_init(action, &ranges);
+    sparse_map_fini(&ranges);
+    if (rc)
+        return rc;
+
+    pho_verb("'%s' is split into %zu chunks, restoring %ju bytes",
+             action->ca_objid, action->ca_nb_chunks, (uintmax_t)size);
+
+    return 0;
+}
+
+/* The copy of a file is deleted once tiered down, its object is then read
+ * without trying the copy first. The copy is read if unsure.
+ */
+static bool ct_restore_copy_exists(struct ct_action *action)
+{
+    const char *res = action->ca_copy_objid;
+    struct object_info *objs;
+    int count;
+
+    if (phobos_op_list(&res, 1, false, NULL, &objs, &count))
+        return true;
+
+    phobos_store_object_list_free(objs, count);
+    if (count == 0)
+        pho_verb("'%s' was deleted, restoring '"DFID"' from '%s'",
+                 action->ca_copy_objid, PFID(&action->ca_hai->hai_fid),
+                 action->ca_objid);
+
+    return count > 0;
+}
+
+/* Tell from the metadata of the object how to write its data to the file,
+ * and how large the restored file is. \p size is the size of the object in
+ * Phobos, negative if unknown.
+ */
+static int ct_restore_object_md(struct ct_action *action,
+                                struct pho_attrs *attrs, ssize_t size)
+{
+    const char *original_size;
+    const char *codec;
+    const char *copy;
+    uint64_t value;
+    int rc;
+
+    action->ca_size = size;
+
+    codec = pho_attr_get(attrs, "compression");
+    if (codec && strcmp(codec, COMPRESS_ZSTD)) {
+        rc = -ENOTSUP;
+        pho_error(rc, "unknown compression '%s' of '%s'", codec,
+                  action->ca_objid);
+        return rc;
+    } else if (codec) {
+        original_size = pho_attr_get(attrs, "original_size");
+        pho_verb("'%s' holds %s compressed data of %s bytes",
+                 action->ca_objid, codec, original_size ? : "?");
+        action->ca_compressed = true;
+
+        action->ca_size = -1;
+        if (original_size && !str2uint64_t(original_size, &value))
+            action->ca_size = value;
+    }
+
+    /* a container holds the data of several files, but nothing else */
+    if (action->ca_packed) {
+        if (action->ca_size >= 0 &&
+            (action->ca_pack_offset > (uint64_t)action->ca_size ||
+             action->ca_pack_length >
+                (uint64_t)action->ca_size - action->ca_pack_offset)) {
+            rc = -EINVAL;
+            pho_error(rc, "'%s' of %zd bytes has no range %ju+%ju",
+                      action->ca_objid, action->ca_size,
+                      (uintmax_t)action->ca_pack_offset,
+                      (uintmax_t)action->ca_pack_length);
+            return rc;
+        }
+
+        action->ca_size = action->ca_pack_length;
+        return 0;
+    }
+
+    rc = ct_restore_map(action, attrs);
+    if (rc)
+        return rc;
+
+    if (action->ca_map.sm_size)
+        action->ca_size = action->ca_map.sm_size;
+
+    rc = ct_restore_chunks_md(action, attrs);
+    if (rc)
+        return rc;
+
+    if (action->ca_chunks)
+        action->ca_size = action->ca_chunks[0].cc_map.sm_size;
+
+    /* the copy holds the same data as the object, on faster media */
+    copy = pho_attr_get(attrs, "copy");
+    if (copy && !action->ca_chunks &&
+        snprintf(action->ca_copy_objid, sizeof(action->ca_copy_objid), "%s",
+                 copy) < (int)sizeof(action->ca_copy_objid))
+        action->ca_from_copy = ct_restore_copy_exists(action);
+
+    return 0;
+}
+
+/* Choose the layout of the restored file: the one it had when archived if
+ * \p restore_lov is set and the object has it, else the one the striping
+ * policy gives for its size. \p layout is NULL if the default layout of the
+ * filesystem applies.
+ */
+static void ct_restore_get_layout(struct ct_action *action,
+                                  struct pho_attrs *attrs, bool restore_lov,
+                                  struct llapi_layout **layout)
+{
+    int rc;
+
+    *layout = NULL;
+
+    if (restore_lov) {
+        rc = layout_from_object_md(attrs, layout);
+        if (!rc)
+            return;
+
+        if (rc != -ENODATA)
+            pho_warn("invalid layout of '%s', will use the striping policy "
+                     "(rc=%d)", action->ca_objid, rc);
+    }
+
+    if (action->ca_size < 0)
+        return;
+
+    rc = stripe_policy_layout(&stripe_policy, action->ca_size, layout);
+    if (rc)
+        pho_warn("cannot build the layout of '%s' from the striping policy, "
+                 "will use default striping (rc=%d)", action->ca_objid, rc);
+    else if (*layout)
+        pho_verb("striping '%s' of %zd bytes according to the policy",
+                 action->ca_objid, action->ca_size);
+}
+
+/* Get the index of the MDT of \p fid, from the cache if its sequence was seen
+ * already.
+ */
+static int ct_get_mdt_index(const struct lu_fid *fid, int *mdt_index)
+{
+    int rc;
+
+    if (mdt_cache_lookup(&mdt_cache, fid->f_seq, mdt_index))
+        return 0;
+
+    rc = llapi_get_mdt_index_by_fid(opt.o_mnt_fd, fid, mdt_index);
+    if (rc < 0) {
+        pho_error(rc, "cannot get mdt index "DFID"", PFID(fid));
+        return rc;
+    }
+
+    mdt_cache_insert(&mdt_cache, fid->f_seq, *mdt_index);
+
+    return 0;
+}
+
+/* Get the object id and the checksum of the restored file from its xattrs, with
+ * a single lookup of the file. The object id of files seen recently is cached.
+ */
+static int ct_restore_file_md(struct ct_action *action, bool *cached)
+{
+    const struct hsm_action_item *hai = action->ca_hai;
+    int fd;
+    int rc;
+
+    *cached = fid_cache_lookup(&objid_cache, &hai->hai_fid, action->ca_objid,
+                               sizeof(action->ca_objid));
+    if (*cached && !opt.o_checksum)
+        return 0;
+
+    fd = llapi_open_by_fid(opt.o_mnt, &hai->hai_fid, O_RDONLY);
+    if (fd < 0)
+        pho_verb("cannot open "DFID" to read its xattrs (rc=%d)",
+                 PFID(&hai->hai_fid), -errno);
+
+    if (!*cached) {
+        rc = fd >= 0 ? ct_fget_xattr(fd, trusted_fuid_xattr, action->ca_objid,
+                                     sizeof(action->ca_objid)) : -EBADF;
+        /* If provided altobjid is used as objectid */
+        if (!rc) {
+            pho_verb("Found objid from xattr of "DFID" : %s",
+                     PFID(&hai->hai_fid), action->ca_objid);
+            fid_cache_insert(&objid_cache, &hai->hai_fid, action->ca_objid);
+        } else {
+            /* only cache the FID based id if the file has no altobjid */
+            bool no_altobjid = rc == -ENODATA;
+
+            rc = fid2objid(&hai->hai_fid, action->ca_objid);
+            if (rc < 0)
+                goto close_fd;
+
+            if (no_altobjid)
+                fid_cache_insert(&objid_cache, &hai->hai_fid,
+                                 action->ca_objid);
+        }
+    }
+
+    /* files archived without checksum are restored without verification */
+    if (fd >= 0 && opt.o_checksum && !ct_fget_checksum(fd, &action->ca_crc))
+        action->ca_verify = true;
+
+    rc = 0;
+
+close_fd:
+    if (fd >= 0)
+        close(fd);
+
+    return rc;
+}
+
+/* The data of a packed file is a range of its container, its fuid refers to
+ * that range.
+ */
+static void ct_restore_pack_ref(struct ct_action *action)
+{
+    char container[PATH_MAX];
+
+    if (str2pack_ref(action->ca_objid, container, sizeof(container),
+                     &action->ca_pack_offset, &action->ca_pack_length))
+        return;
+
+    pho_verb("'"DFID"' is packed at %ju+%ju in '%s'",
+             PFID(&action->ca_hai->hai_fid), (uintmax_t)action->ca_pack_offset,
+             (uintmax_t)action->ca_pack_length, container);
+
+    action->ca_packed = true;
+    snprintf(action->ca_objid, sizeof(action->ca_objid), "%s", container);
+}
+
+/* Find the object of the restored file and fetch its metadata. The file may
+ * have been archived again elsewhere since its object id was cached, by
+ * another copytool for instance, the id is then read again from the file.
+ */
+static int ct_restore_lookup(struct ct_action *action, struct pho_attrs *attrs,
+                             ssize_t *size)
+{
+    const struct lu_fid *fid = &action->ca_hai->hai_fid;
+    bool cached;
+    int rc;
+
+    rc = ct_restore_file_md(action, &cached);
+    if (rc)
+        return rc;
+
+    ct_restore_pack_ref(action);
+    rc = phobos_op_getmd(action->ca_objid, attrs, size);
+    if (rc != -ENOENT || !cached)
+        return rc;
+
+    pho_verb("'%s' no longer exists, looking the object of '"DFID"' up again",
+             action->ca_objid, PFID(fid));
+    fid_cache_invalidate(&objid_cache, fid);
+    action->ca_packed = false;
+
+    rc = ct_restore_file_md(action, &cached);
+    if (rc)
+        return rc;
+
+    ct_restore_pack_ref(action);
+
+    return phobos_op_getmd(action->ca_objid, attrs, size);
+}
+
+/* Allocate the blocks of the data of the restored file at once rather than
+ * letting the writes extend it, to keep large files from being fragmented.
+ * Only the data regions of sparse files are allocated. This is an optimization
+ * only, failures are not fatal.
+ */
+static void ct_restore_preallocate(struct ct_action *action)
+{
+    struct extent whole = { .e_offset = 0, .e_length = action->ca_size };
+    const struct extent *extents = &whole;
+    size_t count = 1;
+    size_t i;
+
+    if (action->ca_size <= 0 || !atomic_load(&fallocate_supported))
+        return;
+
+    if (action->ca_map.sm_size) {
+        extents = action->ca_map.sm_extents;
+        count = action->ca_map.sm_count;
+    }
+
+    for (i = 0; i < count; i++) {
+        int rc;
+
+        if (!extents[i].e_length)
+            continue;
+
+        /* the size of the file is set by the data written to it */
+        if (!fallocate(action->ca_fd, FALLOC_FL_KEEP_SIZE, extents[i].e_offset,
+                       extents[i].e_length))
+            continue;
+
+        rc = -errno;
+        if (rc == -EOPNOTSUPP || rc == -ENOSYS) {
+            pho_verb("fallocate is not supported by '%s', restored files "
+                     "will not be preallocated", opt.o_mnt);
+            atomic_store(&fallocate_supported, false);
+        } else {
+            pho_warn("cannot preallocate %zd bytes for '%s' (rc=%d)",
+                     action->ca_size, action->ca_path, rc);
+        }
+        return;
+    }
+}
+
+/* Create the volatile file receiving the data of the restored file.
+ * Return 1 if there is nothing to transfer.
+ */
+static int ct_restore_prepare(struct ct_action *action, bool restore_lov)
+{
+    const struct hsm_action_item *hai = action->ca_hai;
+    struct llapi_layout *layout = NULL;
+    struct pho_attrs attrs = {0};
+    struct lu_fid dfid;
+    int open_flags = 0;
+    int mdt_index = -1;
+    ssize_t size;
+    int rc;
+
+    /*
+     * we fill lustre so:
+     * source = lustre FID in the backend
+     * destination = data FID = volatile file
+     */
+
+    rc = ct_get_mdt_index(&hai->hai_fid, &mdt_index);
+    if (rc < 0)
+        return rc;
+
+    /* the layout of the volatile file depends on the object metadata */
+    rc = ct_restore_lookup(action, &attrs, &size);
+    if (rc)
+        return rc;
+
+    rc = ct_restore_object_md(action, &attrs, size);
+    if (rc)
+        goto free_attrs;
+
+    ct_restore_get_layout(action, &attrs, restore_lov, &layout);
+    /* the layout is set once the volatile file is created */
+    if (layout)
+        open_flags |= O_LOV_DELAY_CREATE;
+
+    /* start the restore operation */
+    rc = ct_begin_restore(&action->ca_hcp, hai, mdt_index, open_flags);
+    if (rc < 0) {
+        /* the MDT of the sequence may have changed */
+        mdt_cache_invalidate(&mdt_cache, hai->hai_fid.f_seq);
+        goto free_layout;
+    }
+
+    /* get the FID of the volatile file */
+    rc = llapi_hsm_action_get_dfid(action->ca_hcp, &dfid);
+    if (rc < 0) {
+        pho_error(rc, "restoring " DFID ", "
+                      "cannot get FID of created volatile file",
+                  PFID(&hai->hai_fid));
+        goto free_layout;
+    }
+
+    snprintf(action->ca_path, sizeof(action->ca_path), DFID, PFID(&dfid));
+
+    pho_info("restoring data from '" DFID "' to '%s'",
+             PFID(&hai->hai_fid), action->ca_path);
+
+    if (opt.o_dry_run) {
+        rc = 1;
+        goto free_layout;
+    }
+
+    action->ca_fd = llapi_hsm_action_get_fd(action->ca_hcp);
+    if (action->ca_fd < 0) {
+        rc = action->ca_fd;
+        pho_error(rc, "cannot open '%s' for write", action->ca_path);
+        goto free_layout;
+    }
+
+    if (layout) {
+        int rc2;
+
+        rc2 = ct_restore_layout(&dfid, action->ca_fd, layout);
+        if (rc2 < 0)
+            pho_warn("cannot set the layout of '%s', will use default "
+                     "(rc=%d)", action->ca_path, rc2);
+        else
+            pho_verb("set the layout of '"DFID"'", PFID(&hai->hai_fid));
+    }
+
+    /* once the layout is set, as it creates the objects of the file */
+    ct_restore_preallocate(action);
+
+free_layout:
+    llapi_layout_free(layout);
+free_attrs:
+    pho_attrs_free(&attrs);
+
+    return rc;
+}
+
+/* Check the restored data against the checksum of the archived one */
+static int ct_restore_verify(struct ct_action *action, int rc)
+{
+    uint32_t crc;
+
+    if (!rc && action->ca_verify && ct_action_crc(action, &crc) &&
+        crc != action->ca_crc) {
+        rc = -EIO;
+        pho_error(rc, "restored data of '"DFID"' is corrupted: crc32c=%08x, "
+                  "expected %08x", PFID(&action->ca_hai->hai_fid), crc,
+                  action->ca_crc);
+    }
+
+    return rc;
+}
+
+static int ct_restore_fini(struct ct_action *action, int rc)
+{
+    const struct hsm_action_item *hai = action->ca_hai;
+    struct stat st;
+
+    rc = ct_restore_verify(action, rc);
+
+    if (action->ca_fd >= 0) {
+        if (fstat(action->ca_fd, &st) < 0) {
+            rc = -errno;
+            pho_error(rc, "cannot stat dest file '%s'", action->ca_path);
+        } else {
+            pho_info("phobos_get: fid='"DFID"', sz=%lu, rc=%d",
+                     PFID(&hai->hai_fid), st.st_size, rc);
+        }
+        /** @todo make clear rc management */
+    }
+
+    rc = ct_fini(&action->ca_hcp, hai, 0, rc);
+
+    if (action->ca_fd >= 0) {
+        close(action->ca_fd);
+        action->ca_fd = -1;
+    }
+
+    return rc;
+}
+
+/* A file which could not be restored from its copy is not ended, it is
+ * restored again from its own object.
+ */
+static int ct_restore_xfer_fini(struct ct_action *action, int rc)
+{
+    if (!action->ca_from_copy || action->ca_cancelled)
+        return ct_restore_fini(action, rc);
+
+    rc = ct_restore_verify(action, rc);
+    if (!rc) {
+        pho_verb("'"DFID"' restored from its copy '%s'",
+                 PFID(&action->ca_hai->hai_fid), action->ca_copy_objid);
+        ct_copy_restored(action->ca_copy_objid);
+        return ct_restore_fini(action, rc);
+    }
+
+    pho_warn("cannot restore '"DFID"' from '%s', restoring it from '%s' "
+             "(rc=%d)", PFID(&action->ca_hai->hai_fid), action->ca_copy_objid,
+             action->ca_objid, rc);
+    action->ca_fallback = true;
+
+    return 0;
+}
+
+/* Get a file whose copy could not be restored ready to be restored again */
+static void ct_restore_fallback(struct ct_action *action)
+{
+    action->ca_fallback = false;
+    action->ca_from_copy = false;
+
+    /* the data of the copy may run past the end of the file */
+    if (ftruncate(action->ca_fd, 0) < 0)
+        pho_warn("cannot truncate '%s': %s", action->ca_path, strerror(errno));
+
+    pthread_mutex_lock(&inflight_lock);
+    action->ca_pumping = false;
+    action->ca_reported = 0;
+    ct_action_set_state_locked(action, CT_ACTION_PREPARED);
+    pthread_mutex_unlock(&inflight_lock);
+}
+
+static void *ct_chunk_get_thread(void *data)
+{
+    struct ct_chunk *chunk = data;
+
+    phobos_op_get(&chunk->cc_target, 1, NULL, NULL);
+
+    return NULL;
+}
+
+/* Restore the chunks of a split file with a GET each, in parallel, each of
+ * them writing to its own range of the file.
+ */
+static void ct_restore_chunks(struct ct_action *action)
+{
+    int rc;
+
+    rc = ct_action_pump_chunks(action, true, &lane_bandwidth[CT_LANE_RESTORE],
+                               action->ca_verify ? PUMP_CHECKSUM : 0);
+    if (!rc)
+        rc = ct_chunks_transfer(action, ct_chunk_get_thread);
+
+    ct_action_complete(action, ct_restore_fini, rc);
+}
+
+/* Restore the files packed in the same container with a single GET of the
+ * container, to a spool file from which the range of each file is copied.
+ */
+static void ct_restore_pack(struct ct_action **members, size_t count)
+{
+    struct pho_xfer_target xtgt = {0};
+    struct ct_action *first = members[0];
+    struct pump pump;
+    int spool;
+    size_t i;
+    int rc;
+
+    spool = open(opt.o_spool_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (spool < 0) {
+        rc = -errno;
+        pho_error(rc, "cannot create a spool file in '%s'", opt.o_spool_dir);
+        goto complete;
+    }
+
+    rc = pump_start(&pump, spool, true, NULL, &lane_bandwidth[CT_LANE_RESTORE],
+                    first->ca_compressed ? PUMP_DECOMPRESS : 0);
+    if (rc)
+        goto complete;
+
+    pho_info("restoring %zu files from container '%s'", count,
+             first->ca_objid);
+
+    xtgt.xt_objid = first->ca_objid;
+    xtgt.xt_fd = pump_fd(&pump);
+    phobos_op_get(&xtgt, 1, NULL, NULL);
+    rc = pump_stop(&pump);
+    rc = xtgt.xt_rc ? : rc;
+
+complete:
+    for (i = 0; i < count; i++) {
+        struct ct_action *action = members[i];
+        int rc2 = rc;
+
+        if (!rc2)
+            rc2 = pack_copy(spool, action->ca_pack_offset, action->ca_fd, 0,
+                            action->ca_pack_length,
+                            action->ca_verify ? &action->ca_pack_crc : NULL);
+
+        ct_action_complete(action, ct_restore_fini, rc2);
+    }
+
+    if (spool >= 0)
+        close(spool);
+}
+
+static int ct_action_container_cmp(const void *a, const void *b)
+{
+    const struct ct_action *x = *(const struct ct_action **)a;
+    const struct ct_action *y = *(const struct ct_action **)b;
+
+    return strcmp(x->ca_objid, y->ca_objid);
+}
+
+/* Restore packed files, with a GET per container */
+static void ct_restore_packs(struct ct_action **members, size_t count)
+{
+    size_t i = 0;
+
+    qsort(members, count, sizeof(*members), ct_action_container_cmp);
+
+    while (i < count) {
+        size_t group = 1;
+
+        while (i + group < count &&
+               !strcmp(members[i]->ca_objid, members[i + group]->ca_objid))
+            group++;
+
+        ct_restore_pack(&members[i], group);
+        i += group;
+    }
+}
+
+/* Object a restore reads: its copy, unless it failed to be restored */
+static char *ct_restore_objid(struct ct_action *action)
+{
+    return action->ca_from_copy ? action->ca_copy_objid : action->ca_objid;
+}
+
+struct ct_restore_item {
+    struct ct_action *action;
+    char             *medium;  /* NULL if unknown */
+    size_t            index;   /* order of arrival */
+};
+
+/* Known media first, grouped by name, then order of arrival */
+static int ct_restore_item_cmp(const void *a, const void *b)
+{
+    const struct ct_restore_item *x = a;
+    const struct ct_restore_item *y = b;
+    int rc;
+
+    if (x->medium && y->medium)
+        rc = strcmp(x->medium, y->medium);
+    else
+        rc = (x->medium == NULL) - (y->medium == NULL);
+
+    if (rc)
+        return rc;
+
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+static bool ct_same_medium(const struct ct_restore_item *x,
+                           const struct ct_restore_item *y)
+{
+    if (!x->medium || !y->medium)
+        return x->medium == y->medium;
+
+    return !strcmp(x->medium, y->medium);
+}
+
+/* Restore the prepared files, issuing one GET per medium so that each medium
+ * is mounted once for the whole batch. \p items is reordered.
+ */
+static void ct_restore_items(struct ct_restore_item *items, size_t nb_items)
+{
+    struct ct_batch batch = {
+        .cb_fini = ct_restore_xfer_fini,
+    };
+    struct ct_action **packed = NULL;
+    const char **oids = NULL;
+    char **media = NULL;
+    size_t nb_packed = 0;
+    size_t i;
+    int rc;
+
+    batch.cb_targets = calloc(nb_items, sizeof(*batch.cb_targets));
+    batch.cb_actions = calloc(nb_items, sizeof(*batch.cb_actions));
+    oids = calloc(nb_items, sizeof(*oids));
+    media = calloc(nb_items, sizeof(*media));
+    packed = calloc(nb_items, sizeof(*packed));
+    if (!batch.cb_targets || !batch.cb_actions || !oids || !media ||
+        !packed) {
+        for (i = 0; i < nb_items; i++)
+            ct_action_complete(items[i].action, ct_restore_fini, -ENOMEM);
+        goto free_batch;
+    }
+
+    if (nb_items > 1) {
+        for (i = 0; i < nb_items; i++)
+            oids[i] = ct_restore_objid(items[i].action);
+
+        /* without the media, the GETs are issued in order of arrival */
+        rc = phobos_objects_media(oids, nb_items, media);
+        if (rc)
+            pho_warn("cannot locate the objects to restore, rc=%d: %s", rc,
+                     strerror(-rc));
+
+        for (i = 0; i < nb_items; i++)
+            items[i].medium = media[i];
+
+        qsort(items, nb_items, sizeof(*items), ct_restore_item_cmp);
+    }
+
+    for (i = 0; i < nb_items; i++) {
+        struct ct_action *action = items[i].action;
+        const struct sparse_map *map;
+        unsigned int flags = 0;
+
+        if (!ct_action_start(action)) {
+            ct_action_complete(action, ct_restore_fini, -ECANCELED);
+            continue;
+        }
+
+        /* split files are restored on their own, with a GET per chunk */
+        if (action->ca_chunks) {
+            ct_restore_chunks(action);
+            continue;
+        }
+
+        /* packed files are restored by container, once the others are */
+        if (action->ca_packed) {
+            packed[nb_packed++] = action;
+            continue;
+        }
+
+        items[batch.cb_count] = items[i];
+        batch.cb_actions[batch.cb_count] = action;
+        batch.cb_targets[batch.cb_count].xt_objid = ct_restore_objid(action);
+        batch.cb_targets[batch.cb_count].xt_fd = action->ca_fd;
+
+        if (action->ca_verify)
+            flags |= PUMP_CHECKSUM;
+        if (action->ca_compressed)
+            flags |= PUMP_DECOMPRESS;
+
+        /* only sparse objects have a map */
+        map = action->ca_map.sm_size ? &action->ca_map : NULL;
+
+        rc = ct_action_pump(action, &batch.cb_targets[batch.cb_count], true,
+                            map, &lane_bandwidth[CT_LANE_RESTORE], flags);
+        /* the data must not be written to the file as is */
+        if (rc && (action->ca_compressed || map)) {
+            ct_action_complete(action, ct_restore_fini, rc);
+            continue;
+        }
+        batch.cb_count++;
+    }
+
+    i = 0;
+    while (i < batch.cb_count) {
+        size_t group = 1;
+
+        while (i + group < batch.cb_count &&
+               ct_same_medium(&items[i], &items[i + group]))
+            group++;
+
+        if (batch.cb_count > 1)
+            pho_info("restoring %zu objects from medium '%s'", group,
+                     items[i].medium ? : "unknown");
+
+        /* Do phobos xfer, each restore ends as soon as its GET completes */
+        phobos_op_get(&batch.cb_targets[i], group, ct_batch_xfer_done,
+                      &batch);
+
+        i += group;
+    }
+    ct_batch_end(&batch);
+
+    if (nb_packed)
+        ct_restore_packs(packed, nb_packed);
+
+free_batch:
+    if (media)
+        for (i = 0; i < nb_items; i++)
+            free(media[i]);
+    free(media);
+    free(oids);
+    free(packed);
+    free(batch.cb_actions);
+    free(batch.cb_targets);
+}
+
+/* Restore a batch of files, from their copy if they have one. The files
+ * whose copy could not be restored are restored again from their object.
+ */
+static void ct_restore(struct ct_action **actions, size_t count,
+                       bool restore_lov)
+{
+    struct ct_restore_item *items;
+    size_t nb_items = 0;
+    size_t i;
+    int rc;
+
+    items = calloc(count, sizeof(*items));
+    if (!items) {
+        for (i = 0; i < count; i++)
+            ct_action_complete(actions[i], ct_restore_fini, -ENOMEM);
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        rc = ct_restore_prepare(actions[i], restore_lov);
+        if (rc) {
+            /* nothing to transfer is not an error */
+            ct_action_complete(actions[i], ct_restore_fini, rc < 0 ? rc : 0);
+            continue;
+        }
+        ct_action_set_state(actions[i], CT_ACTION_PREPARED);
+        items[nb_items].action = actions[i];
+        items[nb_items].index = nb_items;
+        nb_items++;
+    }
+
+    if (nb_items)
+        ct_restore_items(items, nb_items);
+
+    nb_items = 0;
+    for (i = 0; i < count; i++) {
+        if (!actions[i]->ca_fallback)
+            continue;
+
+        ct_restore_fallback(actions[i]);
+        memset(&items[nb_items], 0, sizeof(items[nb_items]));
+        items[nb_items].action = actions[i];
+        items[nb_items].index = nb_items;
+        nb_items++;
+    }
+
+    if (nb_items)
+        ct_restore_items(items, nb_items);
+
+    free(items);
+}
+
+static int ct_remove_fini(struct ct_action *action, int rc)
+{
+    return ct_fini(&action->ca_hcp, action->ca_hai, 0, rc);
+}
+
+/* Tell whether a file was packed, and in which container, from the object id
+ * given by the hsm_fuid hint or from its fuid. The files themselves are only
+ * looked up if files are being packed.
+ */
+static bool ct_remove_is_packed(const struct lu_fid *fid, const char *objid,
+                                char *container, size_t size)
+{
+    char fuid[PATH_MAX];
+    uint64_t offset;
+    uint64_t length;
+    int fd;
+    int rc;
+
+    if (!str2pack_ref(objid, container, size, &offset, &length))
+        return true;
+
+    if (!fid_cache_lookup(&objid_cache, fid, fuid, sizeof(fuid))) {
+        if (!opt.o_pack_threshold)
+            return false;
+
+        fd = llapi_open_by_fid(opt.o_mnt, fid, O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        rc = ct_fget_xattr(fd, trusted_fuid_xattr, fuid, sizeof(fuid));
+        close(fd);
+        if (rc)
+            return false;
+    }
+
+    return !str2pack_ref(fuid, container, size, &offset, &length);
+}
+
+/* Regular expression matching the objects named after \p objid: the chunks
+ * of a split file and the copy of a file
+ */
+static int ct_remove_others_pattern(const char *objid, char *buf, size_t size)
+{
+    const char *suffix = "\\.(chunk[0-9]+|copy)$";
+    size_t len = 0;
+
+    if (size < 2)
+        return -ENAMETOOLONG;
+    buf[len++] = '^';
+
+    for (; *objid; objid++) {
+        if (len + 2 >= size)
+            return -ENAMETOOLONG;
+        if (strchr("\\^$.|?*+()[]{}", *objid))
+            buf[len++] = '\\';
+        buf[len++] = *objid;
+    }
+
+    if (snprintf(buf + len, size - len, "%s", suffix) >= (int)(size - len))
+        return -ENAMETOOLONG;
+
+    return 0;
+}
+
+/* List the chunks and copies of the objects of \p batch, which are removed
+ * along with them. They are only looked for if files are split or copied.
+ */
+static void ct_remove_others(struct ct_batch *batch,
+                             struct object_info **objs, int *count)
+{
+    char (*patterns)[2 * PATH_MAX];
+    const char **res;
+    size_t n_res = 0;
+    size_t i;
+
+    *objs = NULL;
+    *count = 0;
+
+    if (!opt.o_chunk_threshold && opt.o_copy_family == PHO_RSC_INVAL)
+        return;
+
+    patterns = calloc(batch->cb_count, sizeof(*patterns));
+    res = calloc(batch->cb_count, sizeof(*res));
+    if (!patterns || !res)
+        goto free_patterns;
+
+    for (i = 0; i < batch->cb_count; i++) {
+        if (ct_remove_others_pattern(batch->cb_actions[i]->ca_objid,
+                                     patterns[n_res], sizeof(*patterns)))
+            continue;
+        res[n_res] = patterns[n_res];
+        n_res++;
+    }
+
+    if (n_res)
+        phobos_op_list(res, n_res, true, NULL, objs, count);
+
+free_patterns:
+    free(patterns);
+    free(res);
+}
+
+/* Tell whether \p container is one of the \p count first \p containers */
+static bool ct_remove_has_container(char (*containers)[PATH_MAX], size_t count,
+                                    const char *container)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        if (!strcmp(containers[i], container))
+            return true;
+
+    return false;
+}
+
+/* Remove a batch of objects with a single phobos_delete() */
+static void ct_remove(struct ct_action **actions, size_t count)
+{
+    struct ct_batch batch = {
+        .cb_fini = ct_remove_fini,
+    };
+    struct pho_xfer_target *targets = NULL;
+    struct object_info *others = NULL;
+    char (*containers)[PATH_MAX];
+    size_t nb_containers = 0;
+    size_t nb_targets;
+    size_t nb_extra;
+    int nb_others = 0;
+    size_t i;
+    int rc;
+
+    batch.cb_targets = calloc(count, sizeof(*batch.cb_targets));
+    batch.cb_actions = calloc(count, sizeof(*batch.cb_actions));
+    containers = calloc(count, sizeof(*containers));
+    if (!batch.cb_targets || !batch.cb_actions || !containers) {
+        for (i = 0; i < count; i++)
+            ct_action_complete(actions[i], ct_remove_fini, -ENOMEM);
+        goto free_batch;
+    }
+
+    for (i = 0; i < count; i++) {
+        struct ct_action *action = actions[i];
+        struct hsm_action_item *hai = action->ca_hai;
+        bool packed;
+
+        rc = ct_begin(&action->ca_hcp, hai);
         if (rc < 0)
-            pho_warn("cannot restore file layout for '%s', will use default "
-                     "(rc=%d)", dst, rc);
+            goto fini;
+
+        pho_info("removing '" DFID "'", PFID(&hai->hai_fid));
+
+        if (opt.o_dry_run) {
+            rc = 0;
+            goto fini;
+        }
+
+        rc = ct_remove_objid(&hai->hai_fid, &action->ca_hints,
+                             action->ca_objid, sizeof(action->ca_objid));
+        if (rc)
+            goto fini;
+
+        packed = ct_remove_is_packed(&hai->hai_fid, action->ca_objid,
+                                     containers[nb_containers],
+                                     sizeof(*containers));
+        fid_cache_invalidate(&objid_cache, &hai->hai_fid);
+
+        /* the container is shared with other files, it is only deleted
+         * along with the batch once none of its members uses it
+         */
+        if (packed) {
+            pho_verb("'"DFID"' is packed in '%s'", PFID(&hai->hai_fid),
+                     containers[nb_containers]);
+            if (ct_pack_release(containers[nb_containers], &hai->hai_fid) &&
+                !ct_remove_has_container(containers, nb_containers,
+                                         containers[nb_containers]))
+                nb_containers++;
+            rc = 0;
+            goto fini;
+        }
+
+        ct_action_set_state(action, CT_ACTION_PREPARED);
+        batch.cb_targets[batch.cb_count].xt_objid = action->ca_objid;
+        batch.cb_actions[batch.cb_count++] = action;
+        continue;
+fini:
+        ct_action_complete(action, ct_remove_fini, rc);
+    }
+
+    ct_batch_start(&batch);
+
+    /* the chunks, copies and unused containers are deleted along with the
+     * batch, after it
+     */
+    nb_targets = batch.cb_count;
+    if (batch.cb_count)
+        ct_remove_others(&batch, &others, &nb_others);
+    nb_extra = nb_others + nb_containers;
+    if (nb_extra)
+        targets = realloc(batch.cb_targets,
+                          (nb_targets + nb_extra) * sizeof(*targets));
+    if (targets) {
+        batch.cb_targets = targets;
+        memset(&targets[nb_targets], 0, nb_extra * sizeof(*targets));
+        for (i = 0; i < (size_t)nb_others; i++)
+            targets[nb_targets++].xt_objid = others[i].oid;
+        for (i = 0; i < nb_containers; i++)
+            targets[nb_targets++].xt_objid = containers[i];
+    }
+
+    if (nb_targets == 0)
+        goto free_others;
+
+    if (nb_targets > 1)
+        pho_info("removing %zu objects in a single DELETE", nb_targets);
+
+    /* phobos_delete() has no completion callback */
+    phobos_op_del(batch.cb_targets, nb_targets, 0);
+    ct_batch_end(&batch);
+    if (targets) {
+        ct_copy_forget(&targets[nb_targets - nb_extra], nb_others);
+        ct_pack_drop_ledgers(&targets[nb_targets - nb_containers],
+                             nb_containers);
+    }
+
+free_others:
+    phobos_store_object_list_free(others, nb_others);
+free_batch:
+    free(batch.cb_actions);
+    free(batch.cb_targets);
+    free(containers);
+}
+
+static int ct_process_item(struct ct_action *action)
+{
+    struct hsm_action_item *hai = action->ca_hai;
+    int rc = 0;
+
+    if (opt.o_verbose >= LLAPI_MSG_INFO || opt.o_dry_run) {
+        char fid[FID_LEN];
+
+        sprintf(fid, DFID, PFID(&hai->hai_fid));
+        pho_info("'%s' action %s reclen %d, cookie=%#jx",
+                 fid, hsm_copytool_action2name(hai->hai_action),
+                 hai->hai_len, (uintmax_t)hai->hai_cookie);
+    }
+
+    switch (hai->hai_action) {
+        /* set err_major, minor inside these functions */
+    case HSMA_ARCHIVE:
+        ct_archive(&action, 1);
+        break;
+    case HSMA_RESTORE:
+        ct_restore(&action, 1, opt.o_restore_lov);
+        break;
+    case HSMA_REMOVE:
+        ct_remove(&action, 1);
+        break;
+    default:
+        rc = -EINVAL;
+        pho_error(rc, "unknown action %d, on '%s'", hai->hai_action,
+                  opt.o_mnt);
+        err_minor++;
+        ct_fini(NULL, hai, 0, rc);
+    }
+
+    return 0;
+}
+
+static enum ct_lane ct_action2lane(const struct hsm_action_item *hai)
+{
+    switch (hai->hai_action) {
+    case HSMA_ARCHIVE:
+        return CT_LANE_ARCHIVE;
+    case HSMA_REMOVE:
+        return CT_LANE_REMOVE;
+    default:
+        /* restores, and unknown actions which fail fast, are latency
+         * sensitive
+         */
+        return CT_LANE_RESTORE;
     }
+}
 
-    /* Do phobos xfer */
-    rc = phobos_op_get(&hai->hai_fid, altobj, &hints, dst_fd);
+/* Archives can share a PUT if they have the same hints */
+static bool ct_archive_compat(const void *first, const void *job)
+{
+    const struct ct_action *a = first;
+    const struct ct_action *b = job;
 
-    if(fstat(dst_fd, &st) < 0) {
-        rc = -errno;
-        pho_error(rc, "cannot stat dest file '%s'", dst);
-        goto fini;
+    return a->ca_hints.len == b->ca_hints.len &&
+        (a->ca_hints.len == 0 ||
+         !memcmp(a->ca_hints.data, b->ca_hints.data, a->ca_hints.len));
+}
+
+static void ct_action_free(struct ct_action *action)
+{
+    pthread_mutex_lock(&inflight_lock);
+    if (g_hash_table_lookup(inflight, &action->ca_hai->hai_cookie) == action)
+        g_hash_table_remove(inflight, &action->ca_hai->hai_cookie);
+    pthread_mutex_unlock(&inflight_lock);
+
+    sparse_map_fini(&action->ca_map);
+    free(action->ca_chunks);
+    free(action->ca_hai);
+    free(action);
+}
+
+/* Cancel the action \p hai refers to. Queued actions are dropped right away,
+ * the transfers already handed over to Phobos are aborted.
+ */
+static int ct_cancel(const struct hsm_action_item *hai)
+{
+    enum ct_action_state state;
+    struct ct_action *action;
+    bool dropped = false;
+
+    pthread_mutex_lock(&inflight_lock);
+    action = g_hash_table_lookup(inflight, &hai->hai_cookie);
+    if (!action || action->ca_state == CT_ACTION_DONE) {
+        pthread_mutex_unlock(&inflight_lock);
+        pho_verb("no action to cancel for '"DFID"', cookie=%#jx",
+                 PFID(&hai->hai_fid), (uintmax_t)hai->hai_cookie);
+        return 0;
     }
 
-    pho_info("phobos_get: fid='"DFID"', sz=%lu, rc=%d",
-             PFID(&hai->hai_fid), st.st_size, rc);
-    /** @todo make clear rc management */
+    state = action->ca_state;
+    action->ca_cancelled = true;
+    if (state == CT_ACTION_QUEUED &&
+        !worker_pool_remove(&workers, ct_action2lane(action->ca_hai), action)) {
+        ct_action_set_state_locked(action, CT_ACTION_DONE);
+        dropped = true;
+    } else if (state == CT_ACTION_TRANSFERRING) {
+        ct_action_abort_io(action);
+    }
+    /* unless dropped, the action now belongs to a worker again */
+    pthread_mutex_unlock(&inflight_lock);
 
-fini:
-    llapi_layout_free(layout);
-    rc = ct_fini(&hcp, hai, hp_flags, rc);
+    pho_info("cancelling action on '"DFID"', cookie=%#jx (%s)",
+             PFID(&hai->hai_fid), (uintmax_t)hai->hai_cookie,
+             ct_action_state2str(state));
 
-    if (dst_fd >= 0)
-        close(dst_fd);
+    if (dropped) {
+        ct_fini(NULL, action->ca_hai, 0, -ECANCELED);
+        ct_action_free(action);
+    }
 
-    return rc;
+    return 0;
+}
+
+static void ct_worker(void **jobs, size_t count)
+{
+    struct ct_action **actions = (struct ct_action **)jobs;
+    size_t nb_batched = 0;
+    size_t i;
+
+    if (count == 1) {
+        ct_process_item(actions[0]);
+        ct_action_free(actions[0]);
+        return;
+    }
+
+    /* The restore lane also carries unknown actions, process them first and
+     * keep the batched actions at the beginning of the array.
+     */
+    for (i = 0; i < count; i++) {
+        struct hsm_action_item *hai = actions[i]->ca_hai;
+
+        if (hai->hai_action != HSMA_ARCHIVE &&
+            hai->hai_action != HSMA_RESTORE &&
+            hai->hai_action != HSMA_REMOVE) {
+            ct_process_item(actions[i]);
+            ct_action_free(actions[i]);
+            continue;
+        }
+
+        pho_info("'"DFID"' action %s in a batch of %zu, cookie=%#jx",
+                 PFID(&hai->hai_fid), hsm_copytool_action2name(hai->hai_action),
+                 count, (uintmax_t)hai->hai_cookie);
+        actions[nb_batched++] = actions[i];
+    }
+
+    if (nb_batched == 0)
+        return;
+
+    /* a batch only contains actions from the same lane */
+    switch (actions[0]->ca_hai->hai_action) {
+    case HSMA_ARCHIVE:
+        ct_archive(actions, nb_batched);
+        break;
+    case HSMA_RESTORE:
+        ct_restore(actions, nb_batched, opt.o_restore_lov);
+        break;
+    case HSMA_REMOVE:
+        ct_remove(actions, nb_batched);
+        break;
+    }
+
+    for (i = 0; i < nb_batched; i++)
+        ct_action_free(actions[i]);
+}
+
+/* Progress of an action, taken under the inflight lock and reported to the
+ * coordinator once it is released
+ */
+struct ct_progress {
+    struct ct_action   *cp_action;
+    struct hsm_extent   cp_extent;
+    uint64_t            cp_bytes;
+    bool                cp_pumping;
+    double              cp_rate;     /* MiB/s */
+};
+
+struct ct_progress_snapshot {
+    struct ct_progress *cs_items;
+    size_t              cs_count;
+    double              cs_now;
+};
+
+/* Called with the inflight lock held. The action cannot end until the
+ * progress thread is done reporting it.
+ */
+static void ct_action_snapshot_progress(UNUSED gpointer key, gpointer value,
+                                        gpointer udata)
+{
+    struct ct_progress_snapshot *snapshot = udata;
+    struct ct_action *action = value;
+    struct ct_progress *item;
+    double elapsed;
+    uint64_t bytes;
+
+    /* the other actions have not begun or have already ended */
+    if (action->ca_state != CT_ACTION_PREPARED &&
+        action->ca_state != CT_ACTION_TRANSFERRING)
+        return;
+
+    bytes = action->ca_pumping ? ct_action_bytes(action) :
+                                 action->ca_reported;
+    elapsed = snapshot->cs_now - action->ca_reported_at;
+
+    item = &snapshot->cs_items[snapshot->cs_count++];
+    item->cp_action = action;
+    item->cp_extent.offset = action->ca_hai->hai_extent.offset +
+                             action->ca_reported;
+    item->cp_extent.length = bytes - action->ca_reported;
+    item->cp_bytes = bytes;
+    item->cp_pumping = action->ca_pumping;
+    item->cp_rate = elapsed > 0 ?
+        item->cp_extent.length / elapsed / (1024 * 1024) : 0.;
+
+    action->ca_reported = bytes;
+    action->ca_reported_at = snapshot->cs_now;
+    action->ca_reporting = true;
 }
 
-static int ct_remove(const struct hsm_action_item *hai,
-                     UNUSED const long hal_flags)
+static void ct_action_report_progress(const struct ct_progress *item)
 {
-    struct hsm_copyaction_private *hcp = NULL;
-    struct buf hints;
+    struct ct_action *action = item->cp_action;
+    struct hsm_action_item *hai = action->ca_hai;
     int rc;
 
-    rc = ct_begin(&hcp, hai);
+    /* even without new data, this keeps the request from timing out */
+    rc = llapi_hsm_action_progress(action->ca_hcp, &item->cp_extent,
+                                   action->ca_size, 0);
     if (rc < 0)
-        goto fini;
+        pho_warn("cannot report progress of '"DFID"': %s",
+                 PFID(&hai->hai_fid), strerror(-rc));
 
-    pho_info("removing '" DFID "'", PFID(&hai->hai_fid));
+    if (item->cp_pumping)
+        pho_verb("'"DFID"' %s: %ju bytes transferred (%.1f MiB/s)",
+                 PFID(&hai->hai_fid), hsm_copytool_action2name(hai->hai_action),
+                 (uintmax_t)item->cp_bytes, item->cp_rate);
+}
 
-    hai_get_user_data(hai, &hints);
+static pthread_cond_t progress_cond = PTHREAD_COND_INITIALIZER;
+static bool progress_stopping;
 
-    if (opt.o_dry_run) {
-        rc = 0;
-        goto fini;
+/* Report the progress of every running action every update interval. The
+ * ioctls are made without the inflight lock, which would otherwise hold up
+ * the workers and the cancellations.
+ */
+static void *ct_progress_thread(UNUSED void *data)
+{
+    struct ct_progress_snapshot snapshot;
+    size_t i;
+
+    pthread_mutex_lock(&inflight_lock);
+    while (!progress_stopping) {
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += opt.o_report_interval;
+        pthread_cond_timedwait(&progress_cond, &inflight_lock, &deadline);
+        if (progress_stopping)
+            break;
+
+        snapshot.cs_items = calloc(g_hash_table_size(inflight),
+                                   sizeof(*snapshot.cs_items));
+        if (!snapshot.cs_items)
+            continue;
+        snapshot.cs_count = 0;
+        snapshot.cs_now = ct_now();
+        g_hash_table_foreach(inflight, ct_action_snapshot_progress, &snapshot);
+        pthread_mutex_unlock(&inflight_lock);
+
+        for (i = 0; i < snapshot.cs_count; i++)
+            ct_action_report_progress(&snapshot.cs_items[i]);
+
+        pthread_mutex_lock(&inflight_lock);
+        for (i = 0; i < snapshot.cs_count; i++)
+            snapshot.cs_items[i].cp_action->ca_reporting = false;
+        if (snapshot.cs_count)
+            pthread_cond_broadcast(&reported_cond);
+        free(snapshot.cs_items);
     }
+    pthread_mutex_unlock(&inflight_lock);
 
-    rc = phobos_op_del(&hai->hai_fid, &hints);
+    return NULL;
+}
 
-fini:
-    rc = ct_fini(&hcp, hai, 0, rc);
+static void ct_progress_stop(void)
+{
+    pthread_mutex_lock(&inflight_lock);
+    progress_stopping = true;
+    pthread_cond_signal(&progress_cond);
+    pthread_mutex_unlock(&inflight_lock);
+
+    pthread_join(progress_thread, NULL);
+}
+
+struct ct_tier_down_item {
+    char   *objid;
+    double  last_use;  /* archive or last restore of the copy */
+    long    day;       /* day the copy was made, -1 if it has none */
+    bool    deleted;
+};
+
+/* The copies made before the tier-down age */
+struct ct_tier_down_scan {
+    struct ct_tier_down_item *items;
+    size_t                    count;
+    size_t                    size;
+};
+
+/* Least recently used first */
+static int ct_tier_down_item_cmp(const void *a, const void *b)
+{
+    const struct ct_tier_down_item *x = a;
+    const struct ct_tier_down_item *y = b;
+
+    return (x->last_use > y->last_use) - (x->last_use < y->last_use);
+}
+
+/* Restores older than the limit no longer keep their copy */
+static gboolean ct_copy_restore_expired(UNUSED gpointer key, gpointer value,
+                                        gpointer limit)
+{
+    return *(double *)value <= *(double *)limit;
+}
+
+/* Day recorded in the user_md of a copy, -1 for the copies made before the
+ * days were recorded
+ */
+static long ct_copy_recorded_day(const struct object_info *obj)
+{
+    struct pho_attrs attrs = {0};
+    const char *value;
+    long day = -1;
+
+    if (!obj->user_md || pho_json_to_attrs(&attrs, obj->user_md))
+        goto out;
+
+    value = pho_attr_get(&attrs, COPY_DAY_KEY);
+    if (value)
+        day = strtol(value, NULL, 10);
+
+out:
+    pho_attrs_free(&attrs);
+
+    return day;
+}
+
+/* Add the copies made on \p day, or all of them if \p day is -1, before
+ * \p limit to \p scan
+ */
+static int ct_tier_down_list(long day, double limit,
+                             struct ct_tier_down_scan *scan)
+{
+    const char *pattern = "\\.copy$";
+    struct object_info *objs;
+    char md[64];
+    int nb_objs;
+    int rc;
+    int i;
+
+    snprintf(md, sizeof(md), COPY_DAY_KEY"=%ld", day);
+    rc = phobos_op_list(&pattern, 1, true, day < 0 ? NULL : md, &objs,
+                        &nb_objs);
+    if (rc)
+        return rc;
+
+    for (i = 0; i < nb_objs; i++) {
+        const struct timeval *created = &objs[i].creation_time;
+        double when = created->tv_sec + 0.000001 * created->tv_usec;
+        struct ct_tier_down_item *item;
+
+        if (when > limit)
+            continue;
+
+        if (scan->count == scan->size) {
+            size_t size = scan->size ? scan->size * 2 : 64;
+
+            item = realloc(scan->items, size * sizeof(*item));
+            if (!item) {
+                rc = -ENOMEM;
+                break;
+            }
+            scan->items = item;
+            scan->size = size;
+        }
+
+        item = &scan->items[scan->count];
+        item->objid = strdup(objs[i].oid);
+        if (!item->objid) {
+            rc = -ENOMEM;
+            break;
+        }
+        item->last_use = when;
+        item->day = day < 0 ? ct_copy_recorded_day(&objs[i]) : day;
+        item->deleted = false;
+        scan->count++;
+    }
+
+    phobos_store_object_list_free(objs, nb_objs);
 
     return rc;
 }
 
-static int ct_process_item(struct hsm_action_item *hai, const long hal_flags)
+/* First day of the copies made before the tier-down age which were kept, -1
+ * to list all the copies. Only used by the tier-down thread.
+ */
+static long tier_down_first_day = -1;
+
+/* Delete a batch of the copies neither archived nor restored within the
+ * tier-down age, the least recently used first. Their files are then
+ * restored from their own object, which holds the same data.
+ *
+ * All the copies are listed once, then only the ones made on the days from
+ * the first one which still has copies to the one of the tier-down age.
+ */
+static void ct_tier_down(void)
 {
-    int rc = 0;
+    double limit = ct_now() - opt.o_tier_down_age;
+    long last_day = ct_copy_day(limit);
+    struct ct_tier_down_scan scan = {0};
+    struct pho_xfer_target *targets = NULL;
+    enum pho_xfer_flags flags = 0;
+    size_t nb_items = 0;
+    size_t deleted = 0;
+    long first_day;
+    size_t count;
+    long day;
+    size_t i;
+
+    if (tier_down_first_day < 0) {
+        if (ct_tier_down_list(-1, limit, &scan))
+            goto free_scan;
+    } else {
+        for (day = tier_down_first_day; day <= last_day; day++)
+            if (ct_tier_down_list(day, limit, &scan))
+                goto free_scan;
+    }
 
-    if (opt.o_verbose >= LLAPI_MSG_INFO || opt.o_dry_run) {
-        char fid[FID_LEN];
+    pthread_mutex_lock(&tier_down_lock);
+    for (i = 0; i < scan.count; i++) {
+        double *restored = g_hash_table_lookup(copy_restores,
+                                               scan.items[i].objid);
 
-        sprintf(fid, DFID, PFID(&hai->hai_fid));
-        pho_info("'%s' action %s reclen %d, cookie=%#jx",
-                 fid, hsm_copytool_action2name(hai->hai_action),
-                 hai->hai_len, (uintmax_t)hai->hai_cookie);
+        if (restored && *restored > scan.items[i].last_use)
+            scan.items[i].last_use = *restored;
     }
+    pthread_mutex_unlock(&tier_down_lock);
 
-    switch (hai->hai_action) {
-        /* set err_major, minor inside these functions */
-    case HSMA_ARCHIVE:
-        rc = ct_archive(hai, hal_flags);
-        break;
-    case HSMA_RESTORE:
-        rc = ct_restore(hai, hal_flags, opt.o_restore_lov);
-        break;
-    case HSMA_REMOVE:
-        rc = ct_remove(hai, hal_flags);
-        break;
-    case HSMA_CANCEL:
-        pho_warn("cancel not implemented for file system '%s'",
-                 opt.o_mnt);
-        /*
-         * Don't report progress to coordinator for this cookie:
-         * the copy function will get ECANCELED when reporting
-         * progress.
-         */
-        err_minor++;
-        return 0;
-        break;
-    default:
-        rc = -EINVAL;
-        pho_error(rc, "unknown action %d, on '%s'", hai->hai_action,
-                  opt.o_mnt);
-        err_minor++;
-        ct_fini(NULL, hai, 0, rc);
+    for (i = 0; i < scan.count; i++) {
+        double restored = ct_copy_restore_time(scan.items[i].objid);
+
+        if (restored > scan.items[i].last_use)
+            scan.items[i].last_use = restored;
+    }
+
+    qsort(scan.items, scan.count, sizeof(*scan.items), ct_tier_down_item_cmp);
+    while (nb_items < scan.count && scan.items[nb_items].last_use <= limit)
+        nb_items++;
+
+    if (nb_items == 0)
+        goto next_day;
+
+    count = nb_items;
+    if (count > (size_t)opt.o_tier_down_batch)
+        count = opt.o_tier_down_batch;
+    targets = calloc(count, sizeof(*targets));
+    if (!targets)
+        goto free_scan;
+
+    for (i = 0; i < count; i++)
+        targets[i].xt_objid = scan.items[i].objid;
+
+    if (opt.o_dry_run) {
+        pho_info("tier-down: would delete %zu of the %zu copies unused for "
+                 "%ds", count, nb_items, opt.o_tier_down_age);
+        goto next_day;
+    }
+
+#ifdef HAVE_PHOBOS_HARD_DELETE
+    /* the point is to free the media of the copies */
+    flags = PHO_XFER_OBJ_HARD_DEL;
+#endif
+    phobos_op_del(targets, count, flags);
+    ct_copy_forget(targets, count);
+
+    for (i = 0; i < count; i++) {
+        if (targets[i].xt_rc)
+            continue;
+
+        scan.items[i].deleted = true;
+        deleted++;
+    }
+
+    pho_info("tier-down: deleted %zu of the %zu copies unused for %ds",
+             deleted, nb_items, opt.o_tier_down_age);
+
+next_day:
+    pthread_mutex_lock(&tier_down_lock);
+    g_hash_table_foreach_remove(copy_restores, ct_copy_restore_expired,
+                                &limit);
+    pthread_mutex_unlock(&tier_down_lock);
+
+    /* the copies without a day are only found by listing all the copies */
+    first_day = last_day;
+    for (i = 0; i < scan.count; i++) {
+        if (scan.items[i].deleted)
+            continue;
+
+        if (scan.items[i].day < 0) {
+            first_day = -1;
+            break;
+        }
+
+        if (scan.items[i].day < first_day)
+            first_day = scan.items[i].day;
+    }
+    tier_down_first_day = first_day;
+
+free_scan:
+    free(targets);
+    for (i = 0; i < scan.count; i++)
+        free(scan.items[i].objid);
+    free(scan.items);
+}
+
+static pthread_t tier_down_thread;
+static pthread_cond_t tier_down_cond = PTHREAD_COND_INITIALIZER;
+static bool tier_down_stopping;
+
+/* Delete a batch of copies every tier-down interval */
+static void *ct_tier_down_thread(UNUSED void *data)
+{
+    pthread_mutex_lock(&tier_down_lock);
+    while (!tier_down_stopping) {
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += opt.o_tier_down_interval;
+        pthread_cond_timedwait(&tier_down_cond, &tier_down_lock, &deadline);
+        if (tier_down_stopping)
+            break;
+
+        /* restores record their copy meanwhile */
+        pthread_mutex_unlock(&tier_down_lock);
+        ct_tier_down();
+        pthread_mutex_lock(&tier_down_lock);
+    }
+    pthread_mutex_unlock(&tier_down_lock);
+
+    return NULL;
+}
+
+static int ct_tier_down_start(void)
+{
+    int rc;
+
+    copy_restores = g_hash_table_new_full(g_str_hash, g_str_equal, free,
+                                          free);
+    if (!copy_restores)
+        return -ENOMEM;
+
+    rc = -pthread_create(&tier_down_thread, NULL, ct_tier_down_thread, NULL);
+    if (rc) {
+        g_hash_table_destroy(copy_restores);
+        copy_restores = NULL;
+        return rc;
     }
 
+    pho_info("deleting the copies unused for %ds, at most %d every %ds",
+             opt.o_tier_down_age, opt.o_tier_down_batch,
+             opt.o_tier_down_interval);
+
     return 0;
 }
 
-struct ct_th_data {
-    long                    hal_flags;
-    struct hsm_action_item *hai;
-};
+static void ct_tier_down_stop(void)
+{
+    if (!copy_restores)
+        return;
+
+    pthread_mutex_lock(&tier_down_lock);
+    tier_down_stopping = true;
+    pthread_cond_signal(&tier_down_cond);
+    pthread_mutex_unlock(&tier_down_lock);
+
+    pthread_join(tier_down_thread, NULL);
+    g_hash_table_destroy(copy_restores);
+    copy_restores = NULL;
+}
+
+#define MIB (1024 * 1024)
+
+static void ct_bandwidth_apply(void)
+{
+    int lane;
+
+    throttle_set_rate(&bandwidth, (uint64_t)opt.o_bandwidth * MIB);
+    for (lane = 0; lane < CT_LANE_COUNT; lane++)
+        throttle_set_rate(&lane_bandwidth[lane],
+                          (uint64_t)opt.o_lane_bandwidth[lane] * MIB);
 
-static void *ct_thread(void *data)
+    pho_info("bandwidth limits (MiB/s, 0 if unlimited): total=%d, "
+             "archive=%d, restore=%d", opt.o_bandwidth,
+             opt.o_lane_bandwidth[CT_LANE_ARCHIVE],
+             opt.o_lane_bandwidth[CT_LANE_RESTORE]);
+}
+
+/* The file holds the same limits as --bandwidth, on a single line */
+static int ct_bandwidth_load(const char *path)
 {
-    struct ct_th_data *cttd = data;
+    int lane_rates[CT_LANE_COUNT];
+    char line[256];
+    FILE *file;
+    int total;
     int rc;
 
-    rc = ct_process_item(cttd->hai, cttd->hal_flags);
+    file = fopen(path, "r");
+    if (!file) {
+        rc = -errno;
+        pho_error(rc, "cannot open bandwidth file '%s'", path);
+        return rc;
+    }
+
+    if (!fgets(line, sizeof(line), file))
+        line[0] = '\0';
+    fclose(file);
+    line[strcspn(line, " \t\n")] = '\0';
+
+    /* limits not in the file are unlimited */
+    total = 0;
+    memset(lane_rates, 0, sizeof(lane_rates));
+    rc = parse_bandwidth(line, &total, lane_rates);
+    if (rc) {
+        pho_error(rc, "invalid bandwidth '%s' in '%s'", line, path);
+        return rc;
+    }
+
+    opt.o_bandwidth = total;
+    memcpy(opt.o_lane_bandwidth, lane_rates, sizeof(lane_rates));
+
+    return 0;
+}
+
+static _Atomic bool reload_stopping;
+
+/* Load the bandwidth file again on SIGHUP */
+static void *ct_reload_thread(UNUSED void *data)
+{
+    sigset_t set;
+    int sig;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGHUP);
+
+    while (sigwait(&set, &sig) == 0 && !atomic_load(&reload_stopping)) {
+        if (!opt.o_bandwidth_file) {
+            pho_info("SIGHUP received, no bandwidth file to load");
+            continue;
+        }
+
+        /* keep the current limits on error */
+        if (!ct_bandwidth_load(opt.o_bandwidth_file))
+            ct_bandwidth_apply();
+    }
 
-    free(cttd->hai);
-    free(cttd);
-    pthread_exit((void *)(intptr_t)rc);
+    return NULL;
 }
 
 static int ct_process_item_async(const struct hsm_action_item *hai,
                                  long hal_flags)
 {
-    pthread_attr_t attr;
-    pthread_t thread;
-    struct ct_th_data *data;
+    struct ct_action *action;
     int rc;
 
-    data = malloc(sizeof(*data));
-    if (data == NULL)
+    /* cancels must not wait behind the actions they cancel */
+    if (hai->hai_action == HSMA_CANCEL)
+        return ct_cancel(hai);
+
+    action = calloc(1, sizeof(*action));
+    if (action == NULL)
         return -ENOMEM;
 
-    data->hai = malloc(hai->hai_len);
-    if (data->hai == NULL) {
-        free(data);
+    action->ca_hai = malloc(hai->hai_len);
+    if (action->ca_hai == NULL) {
+        free(action);
         return -ENOMEM;
     }
 
-    memcpy(data->hai, hai, hai->hai_len);
-    data->hal_flags = hal_flags;
+    memcpy(action->ca_hai, hai, hai->hai_len);
+    action->ca_hal_flags = hal_flags;
+    action->ca_fd = -1;
+    hai_get_user_data(action->ca_hai, &action->ca_hints);
 
-    rc = pthread_attr_init(&attr);
-    if (rc != 0) {
-        pho_error(rc, "pthread_attr_init failed for '%s' service",
-                  opt.o_mnt);
-        free(data->hai);
-        free(data);
-        return -rc;
-    }
-
-    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_mutex_lock(&inflight_lock);
+    g_hash_table_insert(inflight, &action->ca_hai->hai_cookie, action);
+    pthread_mutex_unlock(&inflight_lock);
 
-    rc = pthread_create(&thread, &attr, ct_thread, data);
-    if (rc != 0)
-        pho_error(rc, "cannot create thread for '%s' service",
-                  opt.o_mnt);
+    /* the receive loop must not wait for room in a full lane, or it could
+     * not receive the cancellations of the actions holding up the lane
+     */
+    rc = worker_pool_push(&workers, ct_action2lane(hai), action);
+    if (rc) {
+        pho_error(rc, "cannot queue action for '%s' service", opt.o_mnt);
+        ct_action_free(action);
+    }
 
-    pthread_attr_destroy(&attr);
-    return 0;
+    return rc;
 }
 
 static void handler(int signal)
@@ -1269,7 +5155,9 @@ static int ct_run(void)
 {
     struct sigaction cleanup_sigaction;
     int archive_ids_count;
+    sigset_t sighup;
     int *archive_ids;
+    int lane;
     int rc;
 
     if (opt.o_daemonize) {
@@ -1304,6 +5192,75 @@ static int ct_run(void)
         return rc;
     }
 
+    for (lane = 0; lane < CT_LANE_COUNT; lane++) {
+        lanes[lane].wl_name = lane_names[lane];
+        lanes[lane].wl_max_running = opt.o_lane_max[lane];
+        lanes[lane].wl_queue_size = opt.o_lane_max[lane] ? : opt.o_nb_workers;
+        lanes[lane].wl_weight = opt.o_lane_weight[lane];
+        lanes[lane].wl_batch_size = opt.o_batch_size[lane];
+        lanes[lane].wl_batch_delay_ms = opt.o_batch_delay_ms[lane];
+    }
+    lanes[CT_LANE_ARCHIVE].wl_compat = ct_archive_compat;
+
+    inflight = g_hash_table_new(g_int64_hash, g_int64_equal);
+
+    /* Phobos may stop reading from or writing to a pump at any time */
+    signal(SIGPIPE, SIG_IGN);
+
+    throttle_init(&bandwidth, 0, NULL);
+    for (lane = 0; lane < CT_LANE_COUNT; lane++)
+        throttle_init(&lane_bandwidth[lane], 0, &bandwidth);
+
+    if (opt.o_bandwidth_file) {
+        rc = ct_bandwidth_load(opt.o_bandwidth_file);
+        if (rc) {
+            g_hash_table_destroy(inflight);
+            llapi_hsm_copytool_unregister(&ctdata);
+            return rc;
+        }
+    }
+    ct_bandwidth_apply();
+
+    /* only the reload thread receives SIGHUP, the other threads inherit
+     * this mask
+     */
+    sigemptyset(&sighup);
+    sigaddset(&sighup, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &sighup, NULL);
+
+    rc = pthread_create(&progress_thread, NULL, ct_progress_thread, NULL);
+    if (rc) {
+        rc = -rc;
+        pho_error(rc, "failed to start progress reporting");
+        g_hash_table_destroy(inflight);
+        llapi_hsm_copytool_unregister(&ctdata);
+        return rc;
+    }
+
+    rc = worker_pool_init(&workers, opt.o_nb_workers, lanes, CT_LANE_COUNT,
+                          ct_worker);
+    if (rc < 0) {
+        pho_error(rc, "failed to start workers");
+        ct_progress_stop();
+        g_hash_table_destroy(inflight);
+        llapi_hsm_copytool_unregister(&ctdata);
+        return rc;
+    }
+
+    rc = pthread_create(&reload_thread, NULL, ct_reload_thread, NULL);
+    if (rc) {
+        pho_warn("cannot handle SIGHUP, the bandwidth file will not be "
+                 "loaded again: %s", strerror(rc));
+        reload_thread = pthread_self();
+    }
+
+    if (opt.o_tier_down_age) {
+        rc = ct_tier_down_start();
+        if (rc)
+            pho_warn("cannot start the tier-down of the copies: %s",
+                     strerror(-rc));
+    }
+
     memset(&cleanup_sigaction, 0, sizeof(cleanup_sigaction));
     cleanup_sigaction.sa_handler = handler;
     sigemptyset(&cleanup_sigaction.sa_mask);
@@ -1367,6 +5324,20 @@ static int ct_run(void)
             break;
     }
 
+    /* let the workers end the actions they already received */
+    worker_pool_fini(&workers);
+    ct_tier_down_stop();
+    ct_progress_stop();
+    if (!pthread_equal(reload_thread, pthread_self())) {
+        atomic_store(&reload_stopping, true);
+        pthread_kill(reload_thread, SIGHUP);
+        pthread_join(reload_thread, NULL);
+    }
+    g_hash_table_destroy(inflight);
+    for (lane = 0; lane < CT_LANE_COUNT; lane++)
+        throttle_fini(&lane_bandwidth[lane]);
+    throttle_fini(&bandwidth);
+
     llapi_hsm_copytool_unregister(&ctdata);
     if (opt.o_event_fifo != NULL)
         llapi_hsm_unregister_event_fifo(opt.o_event_fifo);
@@ -1395,6 +5366,11 @@ static int ct_setup(void)
         return rc;
     }
 
+    mdt_cache_init(&mdt_cache);
+    fid_cache_init(&objid_cache, OBJID_CACHE_SIZE, 0);
+    fid_cache_init(&dir_cache, DIR_CACHE_SIZE, DIR_CACHE_TTL);
+    uid_cache_init(&uid_cache, UID_CACHE_TTL, UID_CACHE_NEGATIVE_TTL);
+
     return rc;
 }
 
@@ -1402,6 +5378,12 @@ static int ct_cleanup(void)
 {
     int rc;
 
+    stripe_policy_fini(&stripe_policy);
+    mdt_cache_fini(&mdt_cache);
+    fid_cache_fini(&objid_cache);
+    fid_cache_fini(&dir_cache);
+    uid_cache_fini(&uid_cache);
+
     if (opt.o_mnt_fd >= 0) {
         rc = close(opt.o_mnt_fd);
         if (rc < 0) {
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "checksum.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+/* reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82f63b78
+
+/* slicing by 8: crc32c_table[k][b] is the CRC of byte b followed by k zeros */
+static uint32_t crc32c_table[8][256];
+static bool crc32c_hw;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_init(void)
+{
+    uint32_t crc;
+    int i;
+    int j;
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++)
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        crc32c_table[0][i] = crc;
+    }
+
+    for (i = 0; i < 256; i++) {
+        crc = crc32c_table[0][i];
+        for (j = 1; j < 8; j++) {
+            crc = crc32c_table[0][crc & 0xff] ^ (crc >> 8);
+            crc32c_table[j][i] = crc;
+        }
+    }
+
+#if defined(__x86_64__)
+    crc32c_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char *buf, size_t len)
+{
+    while (len && ((uintptr_t)buf & 7)) {
+        crc = crc32c_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+        len--;
+    }
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /* the slicing tables are built for little endian words */
+    while (len >= 8) {
+        uint64_t word;
+
+        memcpy(&word, buf, sizeof(word));
+        word ^= crc;
+        crc = crc32c_table[7][word & 0xff] ^
+              crc32c_table[6][(word >> 8) & 0xff] ^
+              crc32c_table[5][(word >> 16) & 0xff] ^
+              crc32c_table[4][(word >> 24) & 0xff] ^
+              crc32c_table[3][(word >> 32) & 0xff] ^
+              crc32c_table[2][(word >> 40) & 0xff] ^
+              crc32c_table[1][(word >> 48) & 0xff] ^
+              crc32c_table[0][word >> 56];
+        buf += 8;
+        len -= 8;
+    }
+#endif
+
+    while (len--)
+        crc = crc32c_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *buf,
+                             size_t len)
+{
+    uint64_t crc64 = crc;
+
+    while (len && ((uintptr_t)buf & 7)) {
+        crc64 = _mm_crc32_u8(crc64, *buf++);
+        len--;
+    }
+
+    while (len >= 8) {
+        uint64_t word;
+
+        memcpy(&word, buf, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        buf += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        crc64 = _mm_crc32_u8(crc64, *buf++);
+
+    return crc64;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    pthread_once(&crc32c_once, crc32c_init);
+
+    crc = ~crc;
+#if defined(__x86_64__)
+    if (crc32c_hw)
+        return ~crc32c_sse42(crc, buf, len);
+#endif
+    return ~crc32c_sw(crc, buf, len);
+}
+
+/* Multiply the 32x32 GF(2) matrix \p mat by the vector \p vec */
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+
+    for (; vec; vec >>= 1, mat++)
+        if (vec & 1)
+            sum ^= *mat;
+
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
+{
+    int n;
+
+    for (n = 0; n < 32; n++)
+        square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+    uint32_t even[32];
+    uint32_t odd[32];
+    uint32_t row = 1;
+    int n;
+
+    if (len2 == 0)
+        return crc1;
+
+    /* operator for one zero bit */
+    odd[0] = CRC32C_POLY;
+    for (n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    /* operators for two and four zero bits */
+    gf2_matrix_square(even, odd);
+    gf2_matrix_square(odd, even);
+
+    /* apply len2 zero bytes to crc1, the first square giving one zero byte */
+    do {
+        gf2_matrix_square(even, odd);
+        if (len2 & 1)
+            crc1 = gf2_matrix_times(even, crc1);
+        len2 >>= 1;
+        if (!len2)
+            break;
+
+        gf2_matrix_square(odd, even);
+        if (len2 & 1)
+            crc1 = gf2_matrix_times(odd, crc1);
+        len2 >>= 1;
+    } while (len2);
+
+    return crc1 ^ crc2;
+}
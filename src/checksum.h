@@ -0,0 +1,37 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Update a CRC32C (Castagnoli) with \p len bytes of \p buf. The SSE 4.2 crc32
+ * instruction is used when the CPU has it.
+ *
+ * @param[in]  crc  CRC of the previous data, 0 for the first call
+ * @param[in]  buf  data to add to the CRC
+ * @param[in]  len  number of bytes of \p buf
+ *
+ * @return     CRC of the previous data followed by \p buf
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+/**
+ * Compute the CRC32C of two blocks of data from the CRC of each of them, so
+ * that blocks checksummed separately can be checksummed as a whole.
+ *
+ * @param[in]  crc1  CRC of the first block
+ * @param[in]  crc2  CRC of the second block
+ * @param[in]  len2  length of the second block
+ *
+ * @return     CRC of the first block followed by the second one
+ */
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+#endif
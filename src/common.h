@@ -10,6 +10,14 @@
 #include <phobos_store.h>
 #include <glib.h>
 
+/* Actions of the same type share a queue and a concurrency limit */
+enum ct_lane {
+    CT_LANE_RESTORE,
+    CT_LANE_ARCHIVE,
+    CT_LANE_REMOVE,
+    CT_LANE_COUNT,
+};
+
 struct options {
     int              o_daemonize;
     int              o_dry_run;
@@ -22,6 +30,27 @@ struct options {
     enum rsc_family  o_default_family;
     bool             o_restore_lov;
     const char      *o_pid_file;
+    int              o_nb_workers;
+    int              o_lane_max[CT_LANE_COUNT];
+    int              o_lane_weight[CT_LANE_COUNT];
+    int              o_batch_size[CT_LANE_COUNT];
+    int              o_batch_delay_ms[CT_LANE_COUNT];
+    int              o_report_interval;
+    int              o_bandwidth;                    /* MiB/s, 0: unlimited */
+    int              o_lane_bandwidth[CT_LANE_COUNT];
+    const char      *o_bandwidth_file;
+    int              o_checksum;
+    const char      *o_spool_dir;
+    int              o_compress_threads;
+    uint64_t         o_chunk_threshold;              /* bytes, 0: never split */
+    int              o_chunk_count;
+    uint64_t         o_pack_threshold;               /* bytes, 0: never pack */
+    const char      *o_pack_ledger_dir;              /* NULL: never reclaim */
+    enum rsc_family  o_copy_family;                  /* PHO_RSC_INVAL: none */
+    int              o_tier_down_age;                /* s, 0: copies kept */
+    int              o_tier_down_batch;
+    const char      *o_tier_down_dir;                /* NULL: restores lost */
+    int              o_tier_down_interval;           /* s */
 };
 
 /**
@@ -51,4 +80,24 @@ void hinttab_free(struct hinttab *hinttab);
 
 int pho_xfer_add_tag(struct pho_xfer_desc *xfer, const char *new_tag);
 
+/**
+ * Write the whole buffer, retrying on short writes.
+ *
+ * @return     \p len on success, -1 on failure with errno set
+ */
+ssize_t write_all(int fd, const void *buf, size_t len);
+
+/**
+ * Find the medium holding the first extent of each object with a single
+ * metadata request.
+ *
+ * @param[in]  oids    object IDs to locate
+ * @param[in]  count   number of elements of \p oids
+ * @param[out] media   allocated name of the medium of each object, NULL if
+ *                     not found. Each element must be freed by the caller.
+ *
+ * @return     0 on success, negative POSIX error code on failure
+ */
+int phobos_objects_media(const char **oids, size_t count, char **media);
+
 #endif
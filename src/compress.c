@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "compress.h"
+#include "common.h"
+#include "pho_common.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+static bool is_zstd(const char *value, const char **sep)
+{
+    size_t len;
+
+    *sep = strchr(value, ':');
+    len = *sep ? (size_t)(*sep - value) : strlen(value);
+
+    return len == strlen(COMPRESS_ZSTD) && !strncmp(value, COMPRESS_ZSTD, len);
+}
+
+#ifdef HAVE_ZSTD
+
+int compress_parse(const char *value, int *level)
+{
+    const char *sep;
+    char *end;
+    long result;
+
+    if (!is_zstd(value, &sep))
+        return -EINVAL;
+
+    *level = 0;
+    if (!sep)
+        return 0;
+
+    errno = 0;
+    result = strtol(sep + 1, &end, 10);
+    if (errno || end == sep + 1 || *end != '\0' ||
+        result < INT_MIN || result > ZSTD_maxCLevel())
+        return -EINVAL;
+
+    *level = result;
+
+    return 0;
+}
+
+int compress_fd(int in, int out, uint64_t limit, int level, int nb_threads,
+                uint64_t *in_size, uint64_t *out_size)
+{
+    size_t in_cap = ZSTD_CStreamInSize();
+    size_t out_cap = ZSTD_CStreamOutSize();
+    char *inbuf = NULL;
+    char *outbuf = NULL;
+    ZSTD_CCtx *cctx;
+    size_t zrc;
+    int rc = 0;
+
+    *in_size = 0;
+    *out_size = 0;
+
+    cctx = ZSTD_createCCtx();
+    if (!cctx)
+        return -ENOMEM;
+
+    if (level) {
+        zrc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+        if (ZSTD_isError(zrc)) {
+            rc = -EINVAL;
+            pho_error(rc, "invalid zstd level %d: %s", level,
+                      ZSTD_getErrorName(zrc));
+            goto free_cctx;
+        }
+    }
+
+    if (nb_threads) {
+        zrc = ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, nb_threads);
+        /* libzstd may be built without multi-threading support */
+        if (ZSTD_isError(zrc))
+            pho_verb("cannot compress with %d threads: %s", nb_threads,
+                     ZSTD_getErrorName(zrc));
+    }
+
+    inbuf = malloc(in_cap);
+    outbuf = malloc(out_cap);
+    if (!inbuf || !outbuf) {
+        rc = -ENOMEM;
+        goto free_cctx;
+    }
+
+    while (true) {
+        size_t want = in_cap;
+        ZSTD_EndDirective mode;
+        ZSTD_inBuffer input;
+        ssize_t len = 0;
+        bool done;
+
+        if (limit - *in_size < want)
+            want = limit - *in_size;
+
+        if (want) {
+            len = read(in, inbuf, want);
+            if (len < 0 && errno == EINTR)
+                continue;
+            if (len < 0) {
+                rc = -errno;
+                goto free_cctx;
+            }
+        }
+        *in_size += len;
+
+        mode = len == 0 ? ZSTD_e_end : ZSTD_e_continue;
+        input.src = inbuf;
+        input.size = len;
+        input.pos = 0;
+
+        do {
+            ZSTD_outBuffer output = { outbuf, out_cap, 0 };
+
+            zrc = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(zrc)) {
+                rc = -EIO;
+                pho_error(rc, "zstd compression failed: %s",
+                          ZSTD_getErrorName(zrc));
+                goto free_cctx;
+            }
+
+            if (write_all(out, outbuf, output.pos) < 0) {
+                rc = -errno;
+                goto free_cctx;
+            }
+            *out_size += output.pos;
+
+            done = mode == ZSTD_e_end ? zrc == 0 : input.pos == input.size;
+        } while (!done);
+
+        if (mode == ZSTD_e_end)
+            break;
+    }
+
+free_cctx:
+    free(outbuf);
+    free(inbuf);
+    ZSTD_freeCCtx(cctx);
+
+    return rc;
+}
+
+struct decompress {
+    ZSTD_DCtx *d_dctx;
+    char      *d_buf;
+    size_t     d_cap;
+    size_t     d_last;    /* last return value of ZSTD_decompressStream */
+};
+
+int decompress_new(struct decompress **dec)
+{
+    struct decompress *d;
+
+    d = calloc(1, sizeof(*d));
+    if (!d)
+        return -ENOMEM;
+
+    d->d_cap = ZSTD_DStreamOutSize();
+    d->d_buf = malloc(d->d_cap);
+    d->d_dctx = ZSTD_createDCtx();
+    if (!d->d_buf || !d->d_dctx) {
+        decompress_free(d);
+        return -ENOMEM;
+    }
+
+    *dec = d;
+
+    return 0;
+}
+
+int decompress_update(struct decompress *dec, const void *buf, size_t len,
+                      decompress_out_fn_t out, void *udata)
+{
+    ZSTD_inBuffer input = { buf, len, 0 };
+    bool full;
+
+    do {
+        ZSTD_outBuffer output = { dec->d_buf, dec->d_cap, 0 };
+        int rc;
+
+        dec->d_last = ZSTD_decompressStream(dec->d_dctx, &output, &input);
+        if (ZSTD_isError(dec->d_last)) {
+            rc = -EIO;
+            pho_error(rc, "zstd decompression failed: %s",
+                      ZSTD_getErrorName(dec->d_last));
+            return rc;
+        }
+
+        if (output.pos) {
+            rc = out(udata, dec->d_buf, output.pos);
+            if (rc)
+                return rc;
+        }
+
+        /* zstd may hold more data than the output buffer could take */
+        full = output.pos == output.size;
+    } while (input.pos < input.size || full);
+
+    return 0;
+}
+
+int decompress_end(struct decompress *dec)
+{
+    /* 0 once a frame is entirely decoded and flushed */
+    return dec->d_last == 0 ? 0 : -EIO;
+}
+
+void decompress_free(struct decompress *dec)
+{
+    if (!dec)
+        return;
+
+    ZSTD_freeDCtx(dec->d_dctx);
+    free(dec->d_buf);
+    free(dec);
+}
+
+#else /* HAVE_ZSTD */
+
+int compress_parse(const char *value, int *level)
+{
+    const char *sep;
+
+    *level = 0;
+
+    return is_zstd(value, &sep) ? -ENOTSUP : -EINVAL;
+}
+
+int compress_fd(int in, int out, uint64_t limit, int level, int nb_threads,
+                uint64_t *in_size, uint64_t *out_size)
+{
+    (void) in;
+    (void) out;
+    (void) limit;
+    (void) level;
+    (void) nb_threads;
+    *in_size = 0;
+    *out_size = 0;
+
+    return -ENOTSUP;
+}
+
+int decompress_new(struct decompress **dec)
+{
+    *dec = NULL;
+
+    return -ENOTSUP;
+}
+
+int decompress_update(struct decompress *dec, const void *buf, size_t len,
+                      decompress_out_fn_t out, void *udata)
+{
+    (void) dec;
+    (void) buf;
+    (void) len;
+    (void) out;
+    (void) udata;
+
+    return -ENOTSUP;
+}
+
+int decompress_end(struct decompress *dec)
+{
+    (void) dec;
+
+    return -ENOTSUP;
+}
+
+void decompress_free(struct decompress *dec)
+{
+    (void) dec;
+}
+
+#endif /* HAVE_ZSTD */
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Value of the "compression" key of the objects compressed with zstd */
+#define COMPRESS_ZSTD "zstd"
+
+/**
+ * Parse a compression hint of the form "zstd[:level]".
+ *
+ * @param[in]  value  value of the hint
+ * @param[out] level  compression level, 0 for the zstd default
+ *
+ * @return     0 on success, -EINVAL if the value is invalid, -ENOTSUP if the
+ *             copytool was built without zstd
+ */
+int compress_parse(const char *value, int *level);
+
+/**
+ * Compress the data read from \p in to \p out with zstd.
+ *
+ * @param[in]  in          fd to read from
+ * @param[in]  out         fd to write the compressed data to
+ * @param[in]  limit       maximum number of bytes to read from \p in
+ * @param[in]  level       compression level, 0 for the zstd default
+ * @param[in]  nb_threads  number of compression threads, 0 to compress in
+ *                         the calling thread
+ * @param[out] in_size     number of bytes read from \p in
+ * @param[out] out_size    number of bytes written to \p out
+ *
+ * @return     0 on success, negative POSIX error code on failure
+ */
+int compress_fd(int in, int out, uint64_t limit, int level, int nb_threads,
+                uint64_t *in_size, uint64_t *out_size);
+
+struct decompress;
+
+/**
+ * Function receiving the decompressed data.
+ *
+ * @return     0 on success, negative POSIX error code on failure
+ */
+typedef int (*decompress_out_fn_t)(void *udata, const void *buf, size_t len);
+
+/**
+ * @param[out] dec  allocated zstd decompression stream
+ *
+ * @return     0 on success, negative POSIX error code on failure
+ */
+int decompress_new(struct decompress **dec);
+
+/**
+ * Decompress a chunk of compressed data, calling \p out for each block of
+ * decompressed data.
+ *
+ * @return     0 on success, negative POSIX error code on failure
+ */
+int decompress_update(struct decompress *dec, const void *buf, size_t len,
+                      decompress_out_fn_t out, void *udata);
+
+/**
+ * @return     0 if the compressed data ended with a complete frame, -EIO
+ *             otherwise
+ */
+int decompress_end(struct decompress *dec);
+
+void decompress_free(struct decompress *dec);
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "fid_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct fid_entry {
+    struct lu_fid fe_fid;
+    GList         fe_link;     /* in fc_lru */
+    time_t        fe_expire;   /* 0 if the entry does not expire */
+    char          fe_value[];
+};
+
+static guint fid_hash(gconstpointer key)
+{
+    const struct lu_fid *fid = key;
+
+    return (guint)(fid->f_seq ^ (fid->f_seq >> 32)) * 31 + fid->f_oid;
+}
+
+static gboolean fid_equal(gconstpointer a, gconstpointer b)
+{
+    const struct lu_fid *x = a;
+    const struct lu_fid *y = b;
+
+    return x->f_seq == y->f_seq && x->f_oid == y->f_oid &&
+           x->f_ver == y->f_ver;
+}
+
+static time_t fid_cache_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec;
+}
+
+void fid_cache_init(struct fid_cache *cache, size_t capacity, time_t ttl)
+{
+    pthread_mutex_init(&cache->fc_lock, NULL);
+    cache->fc_table = g_hash_table_new(fid_hash, fid_equal);
+    g_queue_init(&cache->fc_lru);
+    cache->fc_capacity = capacity;
+    cache->fc_ttl = ttl;
+}
+
+/* Called with the lock held */
+static void fid_entry_remove(struct fid_cache *cache,
+                             struct fid_entry *entry)
+{
+    g_hash_table_remove(cache->fc_table, &entry->fe_fid);
+    g_queue_unlink(&cache->fc_lru, &entry->fe_link);
+    free(entry);
+}
+
+bool fid_cache_lookup(struct fid_cache *cache, const struct lu_fid *fid,
+                      char *value, size_t size)
+{
+    struct fid_entry *entry;
+    bool found = false;
+
+    pthread_mutex_lock(&cache->fc_lock);
+    entry = g_hash_table_lookup(cache->fc_table, fid);
+    if (entry && entry->fe_expire && entry->fe_expire <= fid_cache_now()) {
+        fid_entry_remove(cache, entry);
+        entry = NULL;
+    }
+
+    if (entry && strlen(entry->fe_value) < size) {
+        strcpy(value, entry->fe_value);
+        /* move the entry to the head of the LRU list */
+        g_queue_unlink(&cache->fc_lru, &entry->fe_link);
+        g_queue_push_head_link(&cache->fc_lru, &entry->fe_link);
+        found = true;
+    }
+    pthread_mutex_unlock(&cache->fc_lock);
+
+    return found;
+}
+
+void fid_cache_insert(struct fid_cache *cache, const struct lu_fid *fid,
+                      const char *value)
+{
+    struct fid_entry *entry;
+    struct fid_entry *old;
+    size_t len = strlen(value);
+
+    if (!cache->fc_capacity)
+        return;
+
+    entry = malloc(sizeof(*entry) + len + 1);
+    if (!entry)
+        return;
+
+    entry->fe_fid = *fid;
+    memset(&entry->fe_link, 0, sizeof(entry->fe_link));
+    entry->fe_link.data = entry;
+    entry->fe_expire = cache->fc_ttl ? fid_cache_now() + cache->fc_ttl : 0;
+    memcpy(entry->fe_value, value, len + 1);
+
+    pthread_mutex_lock(&cache->fc_lock);
+    /* the latest string of the FID replaces any previous one */
+    old = g_hash_table_lookup(cache->fc_table, fid);
+    if (old)
+        fid_entry_remove(cache, old);
+
+    while (g_queue_get_length(&cache->fc_lru) >= cache->fc_capacity)
+        fid_entry_remove(cache,
+                         g_queue_peek_tail_link(&cache->fc_lru)->data);
+
+    g_hash_table_insert(cache->fc_table, &entry->fe_fid, entry);
+    g_queue_push_head_link(&cache->fc_lru, &entry->fe_link);
+    pthread_mutex_unlock(&cache->fc_lock);
+}
+
+void fid_cache_invalidate(struct fid_cache *cache, const struct lu_fid *fid)
+{
+    struct fid_entry *entry;
+
+    pthread_mutex_lock(&cache->fc_lock);
+    entry = g_hash_table_lookup(cache->fc_table, fid);
+    if (entry)
+        fid_entry_remove(cache, entry);
+    pthread_mutex_unlock(&cache->fc_lock);
+}
+
+void fid_cache_fini(struct fid_cache *cache)
+{
+    GList *link;
+
+    if (!cache->fc_table)
+        return;
+
+    while ((link = g_queue_peek_tail_link(&cache->fc_lru)))
+        fid_entry_remove(cache, link->data);
+
+    g_hash_table_destroy(cache->fc_table);
+    cache->fc_table = NULL;
+    pthread_mutex_destroy(&cache->fc_lock);
+}
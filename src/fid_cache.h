@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifndef FID_CACHE_H
+#define FID_CACHE_H
+
+#include <glib.h>
+#include <lustre/lustreapi.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/**
+ * String associated with the most recently used FIDs, such as the object id
+ * of a file or the path of a directory. Once the cache holds fc_capacity
+ * entries, inserting a FID evicts the least recently used one. If fc_ttl is
+ * not 0, an entry is also dropped fc_ttl seconds after it was inserted.
+ */
+struct fid_cache {
+    pthread_mutex_t  fc_lock;
+    GHashTable      *fc_table;     /* FID -> entry */
+    GQueue           fc_lru;       /* entries, most recently used first */
+    size_t           fc_capacity;
+    time_t           fc_ttl;
+};
+
+/**
+ * @param[out] cache     cache to initialize
+ * @param[in]  capacity  maximum number of entries, 0 to disable the cache
+ * @param[in]  ttl       seconds an entry is kept, 0 to keep it until evicted
+ */
+void fid_cache_init(struct fid_cache *cache, size_t capacity, time_t ttl);
+
+/**
+ * @param[in]  cache  cache to look \p fid up in
+ * @param[in]  fid    FID of the file
+ * @param[out] value  string of \p fid, if cached
+ * @param[in]  size   size of \p value
+ *
+ * @return     true if \p fid is cached and its string fits in \p value
+ */
+bool fid_cache_lookup(struct fid_cache *cache, const struct lu_fid *fid,
+                      char *value, size_t size);
+
+void fid_cache_insert(struct fid_cache *cache, const struct lu_fid *fid,
+                      const char *value);
+
+void fid_cache_invalidate(struct fid_cache *cache, const struct lu_fid *fid);
+
+/* May be called on a zeroed cache which was never initialized */
+void fid_cache_fini(struct fid_cache *cache);
+
+#endif
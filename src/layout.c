@@ -10,9 +10,12 @@
 
 #include "layout.h"
 
+#include <ctype.h>
 #include <errno.h>
+#include <glib.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 struct layout_comp {
     uint64_t stripe_count;
@@ -258,9 +261,14 @@ int layout_add_stripe_count(struct llapi_layout *layout, const char *value)
     uint64_t stripe_count;
     int rc;
 
-    rc = str2uint64_t(value, &stripe_count);
-    if (rc)
-        return rc;
+    /* files striped over every OST, see layout_comp2str() */
+    if (!strcmp(value, "-1")) {
+        stripe_count = LLAPI_LAYOUT_WIDE;
+    } else {
+        rc = str2uint64_t(value, &stripe_count);
+        if (rc)
+            return rc;
+    }
 
     rc = llapi_layout_stripe_count_set(layout, stripe_count);
     if (rc)
@@ -330,7 +338,10 @@ int add_component_from_string(struct llapi_layout *layout, const char *csv_comp)
             rc = str2uint64_t(value, &extent_start);
             start_seen = true;
         } else if (!strcmp(key, "extent_end")) {
-            rc = str2uint64_t(value, &extent_end);
+            if (!strcmp(value, "EOF"))
+                extent_end = LUSTRE_EOF;
+            else
+                rc = str2uint64_t(value, &extent_end);
             end_seen = true;
         }
 
@@ -349,17 +360,41 @@ free_striping:
     return rc;
 }
 
-int build_component_name(int index, char **name)
+#define LAYOUT_COMP_PREFIX "layout_comp"
+
+struct layout_comp_md {
+    unsigned long id;
+    const char *value;
+};
+
+static int collect_component(const char *key, const char *value, void *udata)
 {
-    int rc;
+    struct layout_comp_md comp;
+    GArray *comps = udata;
+    char *end;
 
-    rc = asprintf(name, "layout_comp%d", index);
-    if (rc == -1)
-        return -ENOMEM;
+    if (strncmp(key, LAYOUT_COMP_PREFIX, strlen(LAYOUT_COMP_PREFIX)))
+        return 0;
+
+    key += strlen(LAYOUT_COMP_PREFIX);
+    comp.id = strtoul(key, &end, 10);
+    if (end == key || *end != '\0')
+        return 0;
+
+    comp.value = value;
+    g_array_append_val(comps, comp);
 
     return 0;
 }
 
+static int layout_comp_md_cmp(const void *a, const void *b)
+{
+    const struct layout_comp_md *comp_a = a;
+    const struct layout_comp_md *comp_b = b;
+
+    return comp_a->id < comp_b->id ? -1 : comp_a->id > comp_b->id;
+}
+
 int layout_from_object_md(struct pho_attrs *attrs,
                           struct llapi_layout **layout)
 {
@@ -379,38 +414,211 @@ int layout_from_object_md(struct pho_attrs *attrs,
         if (rc)
             goto free_layout;
     } else {
-        char *comp_name;
-        int i = 0;
+        GArray *comps;
+        guint i;
 
-        do {
-            rc = build_component_name(i, &comp_name);
-            if (rc)
-                return -ENOMEM;
+        /* the components are stored by id, which may not be contiguous */
+        comps = g_array_new(false, false, sizeof(struct layout_comp_md));
+        pho_attrs_foreach(attrs, collect_component, comps);
+        g_array_sort(comps, layout_comp_md_cmp);
 
-            value = pho_attr_get(attrs, comp_name);
-            if (!value)
-                break;
+        /* objects archived without their layout */
+        if (comps->len == 0)
+            rc = -ENODATA;
 
-            if (i > 0) {
-                rc = llapi_layout_comp_add(*layout);
-                if (rc)
-                    goto free_layout;
+        for (i = 0; !rc && i < comps->len; i++) {
+            if (i > 0 && llapi_layout_comp_add(*layout)) {
+                rc = -errno;
+                break;
             }
 
-            rc = add_component_from_string(*layout, value);
-            if (rc)
-                goto free_layout;
+            rc = add_component_from_string(*layout,
+                g_array_index(comps, struct layout_comp_md, i).value);
+        }
 
-            i++;
-        } while (value);
+        g_array_free(comps, true);
+        if (rc)
+            goto free_layout;
     }
 
     return 0;
 
 free_layout:
     llapi_layout_free(*layout);
+    *layout = NULL;
     return rc;
 }
+
+int str2size(const char *value, uint64_t *size)
+{
+    static const char suffixes[] = "KMGT";
+    const char *suffix;
+    char *number;
+    size_t len;
+    int rc;
+
+    len = strlen(value);
+    if (len == 0)
+        return -EINVAL;
+
+    suffix = strchr(suffixes, toupper((unsigned char)value[len - 1]));
+    if (!suffix)
+        return str2uint64_t(value, size);
+
+    number = strndup(value, len - 1);
+    if (!number)
+        return -ENOMEM;
+
+    rc = str2uint64_t(number, size);
+    free(number);
+    if (rc)
+        return rc;
+
+    for (; suffix >= suffixes; suffix--) {
+        if (*size > UINT64_MAX / 1024)
+            return -ERANGE;
+        *size *= 1024;
+    }
+
+    return 0;
+}
+
+static int stripe_rule_parse(char *value, struct stripe_rule *rule)
+{
+    char *min_size = strsep(&value, ":");
+    char *count = strsep(&value, ":");
+    char *stripe_size = strsep(&value, ":");
+    char *pool = strsep(&value, ":");
+    int rc;
+
+    /* at most 4 fields, the first two being mandatory */
+    if (!count || value)
+        return -EINVAL;
+
+    rc = str2size(min_size, &rule->sr_min_size);
+    if (rc)
+        return rc;
+
+    if (!strcmp(count, "-1")) {
+        rule->sr_stripe_count = LLAPI_LAYOUT_WIDE;
+    } else {
+        rc = str2uint64_t(count, &rule->sr_stripe_count);
+        if (rc)
+            return rc;
+    }
+
+    rule->sr_stripe_size = LLAPI_LAYOUT_DEFAULT;
+    if (stripe_size && *stripe_size) {
+        rc = str2size(stripe_size, &rule->sr_stripe_size);
+        if (rc)
+            return rc;
+    }
+
+    rule->sr_pool[0] = '\0';
+    if (pool) {
+        if (strlen(pool) >= sizeof(rule->sr_pool))
+            return -ENAMETOOLONG;
+        strcpy(rule->sr_pool, pool);
+    }
+
+    return 0;
+}
+
+static int stripe_rule_cmp(const void *a, const void *b)
+{
+    const struct stripe_rule *rule_a = a;
+    const struct stripe_rule *rule_b = b;
+
+    return rule_a->sr_min_size < rule_b->sr_min_size ? -1 :
+           rule_a->sr_min_size > rule_b->sr_min_size;
+}
+
+int stripe_policy_parse(const char *value, struct stripe_policy *policy)
+{
+    char *rules;
+    char *cur;
+    char *rule;
+    int rc = 0;
+
+    policy->sp_rules = NULL;
+    policy->sp_count = 0;
+
+    rules = strdup(value);
+    if (!rules)
+        return -ENOMEM;
+
+    cur = rules;
+    while ((rule = strsep(&cur, ","))) {
+        struct stripe_rule *tmp;
+
+        tmp = realloc(policy->sp_rules,
+                      (policy->sp_count + 1) * sizeof(*tmp));
+        if (!tmp) {
+            rc = -ENOMEM;
+            break;
+        }
+        policy->sp_rules = tmp;
+
+        rc = stripe_rule_parse(rule, &policy->sp_rules[policy->sp_count]);
+        if (rc)
+            break;
+
+        policy->sp_count++;
+    }
+    free(rules);
+
+    if (rc) {
+        stripe_policy_fini(policy);
+        return rc;
+    }
+
+    qsort(policy->sp_rules, policy->sp_count, sizeof(*policy->sp_rules),
+          stripe_rule_cmp);
+
+    return 0;
+}
+
+int stripe_policy_layout(const struct stripe_policy *policy, uint64_t size,
+                         struct llapi_layout **layout)
+{
+    const struct stripe_rule *rule = NULL;
+    size_t i;
+
+    *layout = NULL;
+
+    for (i = 0; i < policy->sp_count; i++) {
+        if (policy->sp_rules[i].sr_min_size > size)
+            break;
+        rule = &policy->sp_rules[i];
+    }
+
+    if (!rule)
+        return 0;
+
+    *layout = llapi_layout_alloc();
+    if (!*layout)
+        return -ENOMEM;
+
+    if (llapi_layout_stripe_count_set(*layout, rule->sr_stripe_count) ||
+        llapi_layout_stripe_size_set(*layout, rule->sr_stripe_size) ||
+        (rule->sr_pool[0] &&
+         llapi_layout_pool_name_set(*layout, rule->sr_pool))) {
+        int rc = -errno;
+
+        llapi_layout_free(*layout);
+        *layout = NULL;
+        return rc;
+    }
+
+    return 0;
+}
+
+void stripe_policy_fini(struct stripe_policy *policy)
+{
+    free(policy->sp_rules);
+    policy->sp_rules = NULL;
+    policy->sp_count = 0;
+}
 /*
  * vim:expandtab:shiftwidth=4:tabstop=4:
  */
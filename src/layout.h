@@ -42,6 +42,57 @@ int layout_component2str(struct llapi_layout *layout, char **str);
  */
 int str2uint64_t(const char *value, uint64_t *result);
 
+/**
+ * Convert a size with an optional K, M, G or T suffix into a number of bytes
+ *
+ * \param[in]  value  string representing the size
+ * \param[out] size   number of bytes
+ *
+ * \return            0 on success, negative POSIX error code on error
+ */
+int str2size(const char *value, uint64_t *size);
+
+/* Striping of the files of at least sr_min_size bytes */
+struct stripe_rule {
+    uint64_t sr_min_size;
+    uint64_t sr_stripe_count;   /* LLAPI_LAYOUT_WIDE for every OST */
+    uint64_t sr_stripe_size;    /* LLAPI_LAYOUT_DEFAULT if not set */
+    char     sr_pool[LOV_MAXPOOLNAME + 1];
+};
+
+/* Rules sorted by increasing minimum size */
+struct stripe_policy {
+    struct stripe_rule *sp_rules;
+    size_t              sp_count;
+};
+
+/**
+ * Parse a striping policy of the form
+ * "<min size>:<stripe count>[:<stripe size>[:<pool>]],...". Sizes accept the
+ * K, M, G and T suffixes, a stripe count of -1 stripes over every OST.
+ *
+ * \param[in]  value   policy to parse
+ * \param[out] policy  parsed policy, to be freed with stripe_policy_fini()
+ *
+ * \return             0 on success, -EINVAL if \p value is invalid
+ */
+int stripe_policy_parse(const char *value, struct stripe_policy *policy);
+
+/**
+ * Build the layout of a file of \p size bytes according to \p policy.
+ *
+ * \param[in]  policy  striping policy
+ * \param[in]  size    size of the file
+ * \param[out] layout  layout of the file, NULL if no rule applies to files
+ *                     of \p size bytes
+ *
+ * \return             0 on success, negative POSIX error code on failure
+ */
+int stripe_policy_layout(const struct stripe_policy *policy, uint64_t size,
+                         struct llapi_layout **layout);
+
+void stripe_policy_fini(struct stripe_policy *policy);
+
 #endif
 /*
  * vim:expandtab:shiftwidth=4:tabstop=4:
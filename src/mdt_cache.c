@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "mdt_cache.h"
+
+void mdt_cache_init(struct mdt_cache *cache)
+{
+    pthread_rwlock_init(&cache->mc_lock, NULL);
+    cache->mc_table = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                            g_free, NULL);
+}
+
+bool mdt_cache_lookup(struct mdt_cache *cache, uint64_t seq, int *mdt_index)
+{
+    gint64 key = seq;
+    gpointer value;
+    bool found;
+
+    pthread_rwlock_rdlock(&cache->mc_lock);
+    found = g_hash_table_lookup_extended(cache->mc_table, &key, NULL, &value);
+    pthread_rwlock_unlock(&cache->mc_lock);
+
+    if (found)
+        *mdt_index = GPOINTER_TO_INT(value);
+
+    return found;
+}
+
+void mdt_cache_insert(struct mdt_cache *cache, uint64_t seq, int mdt_index)
+{
+    gint64 *key = g_new(gint64, 1);
+
+    *key = seq;
+
+    pthread_rwlock_wrlock(&cache->mc_lock);
+    if (g_hash_table_size(cache->mc_table) >= MDT_CACHE_MAX_ENTRIES)
+        g_hash_table_remove_all(cache->mc_table);
+    g_hash_table_replace(cache->mc_table, key, GINT_TO_POINTER(mdt_index));
+    pthread_rwlock_unlock(&cache->mc_lock);
+}
+
+void mdt_cache_invalidate(struct mdt_cache *cache, uint64_t seq)
+{
+    gint64 key = seq;
+
+    pthread_rwlock_wrlock(&cache->mc_lock);
+    g_hash_table_remove(cache->mc_table, &key);
+    pthread_rwlock_unlock(&cache->mc_lock);
+}
+
+void mdt_cache_fini(struct mdt_cache *cache)
+{
+    if (!cache->mc_table)
+        return;
+
+    g_hash_table_destroy(cache->mc_table);
+    cache->mc_table = NULL;
+    pthread_rwlock_destroy(&cache->mc_lock);
+}
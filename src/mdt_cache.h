@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifndef MDT_CACHE_H
+#define MDT_CACHE_H
+
+#include <glib.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Index of the MDT of each FID sequence. All the FIDs of a sequence are
+ * allocated by the same MDT, so the cache is filled from the MDT index of any
+ * FID of the sequence. Lookups may run concurrently.
+ */
+struct mdt_cache {
+    pthread_rwlock_t  mc_lock;
+    GHashTable       *mc_table;   /* sequence -> MDT index */
+};
+
+/* Once full, the cache is emptied to be filled again */
+#define MDT_CACHE_MAX_ENTRIES 65536
+
+void mdt_cache_init(struct mdt_cache *cache);
+
+/**
+ * @param[in]  cache      cache to look \p seq up in
+ * @param[in]  seq        FID sequence
+ * @param[out] mdt_index  MDT index of \p seq, if cached
+ *
+ * @return     true if \p seq is cached
+ */
+bool mdt_cache_lookup(struct mdt_cache *cache, uint64_t seq, int *mdt_index);
+
+void mdt_cache_insert(struct mdt_cache *cache, uint64_t seq, int mdt_index);
+
+/**
+ * Forget the MDT index of \p seq, for instance when using it failed.
+ */
+void mdt_cache_invalidate(struct mdt_cache *cache, uint64_t seq);
+
+/* May be called on a zeroed cache which was never initialized */
+void mdt_cache_fini(struct mdt_cache *cache);
+
+#endif
@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "pack.h"
+#include "checksum.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PACK_COPY_SIZE (1024 * 1024)
+
+int pack_index2str(const struct pack_member *members, size_t count, bool crc,
+                   char **str)
+{
+    size_t len;
+    FILE *out;
+    size_t i;
+
+    out = open_memstream(str, &len);
+    if (!out)
+        return -ENOMEM;
+
+    for (i = 0; i < count; i++) {
+        fprintf(out, "%s%s@%ju+%ju", i ? "," : "", members[i].pm_id,
+                (uintmax_t)members[i].pm_offset,
+                (uintmax_t)members[i].pm_length);
+        if (crc)
+            fprintf(out, "/%08x", members[i].pm_crc);
+    }
+
+    if (fclose(out)) {
+        free(*str);
+        *str = NULL;
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+size_t pack_index_count(const char *str)
+{
+    size_t count = 1;
+
+    if (!str || !*str)
+        return 0;
+
+    for (; *str; str++)
+        if (*str == ',')
+            count++;
+
+    return count;
+}
+
+int pack_ref2str(const char *container, uint64_t offset, uint64_t length,
+                 char *buf, size_t size)
+{
+    int rc;
+
+    rc = snprintf(buf, size, PACK_REF_PREFIX "%s@%ju+%ju", container,
+                  (uintmax_t)offset, (uintmax_t)length);
+
+    return rc >= (int)size ? -ENAMETOOLONG : 0;
+}
+
+/* Parse the decimal number of \p len bytes at \p str */
+static int pack_number(const char *str, size_t len, uint64_t *value)
+{
+    unsigned long long result = 0;
+    size_t i;
+
+    if (len == 0 || len > 20)
+        return -EINVAL;
+
+    for (i = 0; i < len; i++) {
+        if (str[i] < '0' || str[i] > '9')
+            return -EINVAL;
+        if (result > (UINT64_MAX - (str[i] - '0')) / 10)
+            return -EINVAL;
+        result = result * 10 + (str[i] - '0');
+    }
+
+    *value = result;
+
+    return 0;
+}
+
+int str2pack_ref(const char *ref, char *container, size_t size,
+                 uint64_t *offset, uint64_t *length)
+{
+    const char *length_str;
+    const char *offset_str;
+    size_t len;
+
+    if (strncmp(ref, PACK_REF_PREFIX, strlen(PACK_REF_PREFIX)))
+        return -EINVAL;
+    ref += strlen(PACK_REF_PREFIX);
+
+    offset_str = strrchr(ref, '@');
+    if (!offset_str || offset_str == ref)
+        return -EINVAL;
+
+    length_str = strchr(offset_str, '+');
+    if (!length_str)
+        return -EINVAL;
+
+    if (pack_number(length_str + 1, strlen(length_str + 1), length) ||
+        pack_number(offset_str + 1, length_str - offset_str - 1, offset))
+        return -EINVAL;
+
+    len = offset_str - ref;
+    if (len >= size)
+        return -ENAMETOOLONG;
+
+    memcpy(container, ref, len);
+    container[len] = '\0';
+
+    return 0;
+}
+
+int pack_copy(int in, uint64_t in_offset, int out, uint64_t out_offset,
+              uint64_t length, uint32_t *crc)
+{
+    char *buf;
+    int rc = 0;
+
+    buf = malloc(PACK_COPY_SIZE);
+    if (!buf)
+        return -ENOMEM;
+
+    if (crc)
+        *crc = 0;
+
+    while (length) {
+        size_t want = length < PACK_COPY_SIZE ? length : PACK_COPY_SIZE;
+        ssize_t done = 0;
+        ssize_t len;
+
+        len = pread(in, buf, want, in_offset);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0) {
+            rc = -errno;
+            break;
+        }
+        /* the input is shorter than expected */
+        if (len == 0) {
+            rc = -EIO;
+            break;
+        }
+
+        if (crc)
+            *crc = crc32c(*crc, buf, len);
+
+        while (done < len) {
+            ssize_t written;
+
+            written = pwrite(out, buf + done, len - done, out_offset + done);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written < 0) {
+                rc = -errno;
+                goto free_buf;
+            }
+            done += written;
+        }
+
+        in_offset += len;
+        out_offset += len;
+        length -= len;
+    }
+
+free_buf:
+    free(buf);
+
+    return rc;
+}
+
+static int pack_ledger_path(const char *dir, const char *container, char *buf,
+                            size_t size)
+{
+    int rc;
+
+    if (strchr(container, '/') || !strcmp(container, ".") ||
+        !strcmp(container, ".."))
+        return -EINVAL;
+
+    rc = snprintf(buf, size, "%s/%s", dir, container);
+
+    return rc >= (int)size ? -ENAMETOOLONG : 0;
+}
+
+static int pack_strcmp(const void *a, const void *b)
+{
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* Number of distinct lines of \p buf, which is modified */
+static size_t pack_ledger_count(char *buf, size_t len)
+{
+    char *line = buf;
+    size_t nb_lines = 0;
+    size_t count = 0;
+    char **lines;
+    char *end;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        if (buf[i] == '\n')
+            nb_lines++;
+
+    lines = calloc(nb_lines ? : 1, sizeof(*lines));
+    if (!lines)
+        return 0;
+
+    /* an incomplete last line is being appended by someone else */
+    nb_lines = 0;
+    while ((end = memchr(line, '\n', buf + len - line))) {
+        *end = '\0';
+        lines[nb_lines++] = line;
+        line = end + 1;
+    }
+
+    qsort(lines, nb_lines, sizeof(*lines), pack_strcmp);
+    for (i = 0; i < nb_lines; i++)
+        if (i == 0 || strcmp(lines[i - 1], lines[i]))
+            count++;
+
+    free(lines);
+
+    return count;
+}
+
+int pack_ledger_add(const char *dir, const char *container,
+                    const char *member, size_t *removed)
+{
+    char line[PATH_MAX + 1];
+    char path[PATH_MAX];
+    size_t done = 0;
+    ssize_t written;
+    struct stat st;
+    char *buf;
+    ssize_t len;
+    int rc;
+    int fd;
+
+    rc = pack_ledger_path(dir, container, path, sizeof(path));
+    if (rc)
+        return rc;
+
+    len = snprintf(line, sizeof(line), "%s\n", member);
+    if (len >= (ssize_t)sizeof(line))
+        return -ENAMETOOLONG;
+
+    fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return -errno;
+
+    /* a single write, so that the lines of several writers do not mix */
+    written = write(fd, line, len);
+    if (written != len) {
+        rc = written < 0 ? -errno : -EIO;
+        goto close_fd;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        rc = -errno;
+        goto close_fd;
+    }
+
+    buf = malloc(st.st_size + 1);
+    if (!buf) {
+        rc = -ENOMEM;
+        goto close_fd;
+    }
+
+    while (done < (size_t)st.st_size) {
+        len = pread(fd, buf + done, st.st_size - done, done);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0) {
+            rc = -errno;
+            goto free_buf;
+        }
+        if (len == 0)
+            break;
+        done += len;
+    }
+
+    *removed = pack_ledger_count(buf, done);
+
+free_buf:
+    free(buf);
+close_fd:
+    close(fd);
+
+    return rc;
+}
+
+int pack_ledger_drop(const char *dir, const char *container)
+{
+    char path[PATH_MAX];
+    int rc;
+
+    rc = pack_ledger_path(dir, container, path, sizeof(path));
+    if (rc)
+        return rc;
+
+    if (unlink(path) < 0 && errno != ENOENT)
+        return -errno;
+
+    return 0;
+}
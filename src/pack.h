@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A file stored in a range of a container object shared with other files */
+struct pack_member {
+    const char *pm_id;      /* identifier of the file */
+    uint64_t    pm_offset;  /* offset of its data in the container */
+    uint64_t    pm_length;
+    uint32_t    pm_crc;     /* CRC32C of its data, if the index has them */
+};
+
+/**
+ * Encode the index of a container as "id@offset+length[/crc32c],...".
+ *
+ * @param[in]  members  files stored in the container
+ * @param[in]  count    number of \p members
+ * @param[in]  crc      true to record the CRC32C of each member
+ * @param[out] str      allocated string, to be freed by the caller
+ *
+ * @return     0 on success, -ENOMEM on failure
+ */
+int pack_index2str(const struct pack_member *members, size_t count, bool crc,
+                   char **str);
+
+/**
+ * Number of members of the index \p str encoded by pack_index2str().
+ */
+size_t pack_index_count(const char *str);
+
+/**
+ * References to the data of a member start with this prefix, which object ids
+ * built from a Lustre fsname cannot start with.
+ */
+#define PACK_REF_PREFIX "pack@"
+
+/**
+ * Build the reference "pack@container@offset+length" to the data of a member.
+ *
+ * @return     0 on success, -ENAMETOOLONG if \p size is too small
+ */
+int pack_ref2str(const char *container, uint64_t offset, uint64_t length,
+                 char *buf, size_t size);
+
+/**
+ * Decode a reference built by pack_ref2str(). The id of a container may
+ * contain '@', the offset and the length follow the last one.
+ *
+ * @param[in]  ref        reference to decode
+ * @param[out] container  id of the container
+ * @param[in]  size       size of \p container
+ * @param[out] offset     offset of the data in the container
+ * @param[out] length     length of the data
+ *
+ * @return     0 on success, -EINVAL if \p ref is not a reference,
+ *             -ENAMETOOLONG if \p size is too small
+ */
+int str2pack_ref(const char *ref, char *container, size_t size,
+                 uint64_t *offset, uint64_t *length);
+
+/**
+ * Copy \p length bytes from \p in at \p in_offset to \p out at
+ * \p out_offset.
+ *
+ * @param[out] crc  CRC32C of the data copied, NULL not to compute it
+ *
+ * @return     0 on success, -EIO if \p in ends before, negative POSIX error
+ *             code on failure
+ */
+int pack_copy(int in, uint64_t in_offset, int out, uint64_t out_offset,
+              uint64_t length, uint32_t *crc);
+
+/**
+ * Record in the ledger of \p container, a file of \p dir named after it, that
+ * \p member no longer uses its range. The ledger is appended to, so that it
+ * can be shared by several copytools.
+ *
+ * @param[in]  dir        directory of the ledgers
+ * @param[in]  container  id of the container
+ * @param[in]  member     id of the member, as in the index of the container
+ * @param[out] removed    number of distinct members recorded so far
+ *
+ * @return     0 on success, -EINVAL if \p container cannot name a file,
+ *             negative POSIX error code on failure
+ */
+int pack_ledger_add(const char *dir, const char *container,
+                    const char *member, size_t *removed);
+
+/**
+ * Delete the ledger of \p container, once the container is deleted.
+ *
+ * @return     0 on success or if there is no ledger, negative POSIX error code
+ *             on failure
+ */
+int pack_ledger_drop(const char *dir, const char *container);
+
+#endif
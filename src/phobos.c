@@ -1,5 +1,9 @@
 #define _GNU_SOURCE
 
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
 #include "common.h"
 
 #include <errno.h>
@@ -27,3 +31,58 @@ int pho_xfer_add_tag(struct pho_xfer_desc *xfer, const char *new_tag)
 
     return 0;
 }
+
+int phobos_objects_media(const char **oids, size_t count, char **media)
+{
+#ifdef HAVE_PHOBOS_ADMIN_LAYOUT_LIST
+    struct layout_info *layouts = NULL;
+    struct admin_handle adm;
+    int n_layouts = 0;
+    size_t i;
+    int rc;
+    int j;
+
+    for (i = 0; i < count; i++)
+        media[i] = NULL;
+
+    /* only the DSS is queried, phobosd is not needed */
+    rc = phobos_admin_init(&adm, false, NULL);
+    if (rc)
+        return rc;
+
+    rc = phobos_admin_layout_list(&adm, oids, count, false, NULL, &layouts,
+                                  &n_layouts, NULL);
+    if (rc)
+        goto fini;
+
+    for (j = 0; j < n_layouts; j++) {
+        if (layouts[j].ext_count == 0)
+            continue;
+
+        for (i = 0; i < count; i++) {
+            if (media[i] || strcmp(oids[i], layouts[j].oid))
+                continue;
+
+            media[i] = strdup(layouts[j].extents[0].media.name);
+            if (!media[i]) {
+                rc = -errno;
+                goto free_layouts;
+            }
+            pho_debug("object '%s' located on '%s'", oids[i], media[i]);
+        }
+    }
+
+free_layouts:
+    phobos_admin_layout_list_free(layouts, n_layouts);
+fini:
+    phobos_admin_fini(&adm);
+
+    return rc;
+#else
+    (void) oids;
+
+    memset(media, 0, count * sizeof(*media));
+
+    return -ENOTSUP;
+#endif
+}
@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "pump.h"
+#include "checksum.h"
+#include "common.h"
+#include "compress.h"
+#include "pho_common.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PUMP_CHUNK_SIZE (1024 * 1024)
+/* time after which a second pipe nobody reads from is given up */
+#define PUMP_TEE_TIMEOUT_MS (30 * 1000)
+
+ssize_t write_all(int fd, const void *buf, size_t len)
+{
+    size_t written = 0;
+
+    while (written < len) {
+        ssize_t rc = write(fd, (const char *)buf + written, len - written);
+
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0)
+            return -1;
+
+        written += rc;
+    }
+
+    return written;
+}
+
+static ssize_t pwrite_all(int fd, const void *buf, size_t len, off_t offset)
+{
+    size_t written = 0;
+
+    while (written < len) {
+        ssize_t rc = pwrite(fd, (const char *)buf + written, len - written,
+                            offset + written);
+
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0)
+            return -1;
+
+        written += rc;
+    }
+
+    return written;
+}
+
+/* Get the range of the file to copy next, false once the map is copied */
+static bool pump_range(struct pump *pump, uint64_t *offset, uint64_t *length)
+{
+    const struct sparse_map *map = pump->p_map;
+
+    if (!map) {
+        *offset = pump->p_offset;
+        *length = UINT64_MAX;
+        return true;
+    }
+
+    if (pump->p_extent == map->sm_count)
+        return false;
+
+    *offset = map->sm_extents[pump->p_extent].e_offset + pump->p_offset;
+    *length = map->sm_extents[pump->p_extent].e_length - pump->p_offset;
+
+    return true;
+}
+
+/* Account for \p len bytes read from or written to the file */
+static void pump_advance(struct pump *pump, size_t len)
+{
+    const struct sparse_map *map = pump->p_map;
+
+    pump->p_offset += len;
+    if (map && pump->p_offset == map->sm_extents[pump->p_extent].e_length) {
+        pump->p_extent++;
+        pump->p_offset = 0;
+    }
+
+    atomic_fetch_add(&pump->p_bytes, len);
+
+    if (pump->p_throttle)
+        throttle_acquire(pump->p_throttle, len);
+}
+
+/* Write to the non-blocking second pipe, failing with ETIMEDOUT if its reader
+ * does not read for PUMP_TEE_TIMEOUT_MS. The reader may be waiting for a
+ * device held by a transfer which itself waits for this pump to write to its
+ * first pipe, blocking on the second pipe could thus never end.
+ */
+static int pump_tee_write(struct pump *pump, const char *buf, size_t len)
+{
+    size_t written = 0;
+
+    while (written < len) {
+        struct pollfd pfd = { .fd = pump->p_tee, .events = POLLOUT };
+        ssize_t rc;
+
+        rc = write(pump->p_tee, buf + written, len - written);
+        if (rc >= 0) {
+            written += rc;
+            continue;
+        }
+
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN)
+            return -errno;
+
+        rc = poll(&pfd, 1, PUMP_TEE_TIMEOUT_MS);
+        if (rc == 0)
+            return -ETIMEDOUT;
+        if (rc < 0 && errno != EINTR)
+            return -errno;
+    }
+
+    return 0;
+}
+
+/* The data goes through a buffer to be checksummed, in a single pass */
+static ssize_t pump_copy_checksum(struct pump *pump, char *buf, size_t len,
+                                  off_t offset)
+{
+    ssize_t rc;
+
+    if (pump->p_to_file)
+        rc = read(pump->p_pipe, buf, len);
+    else
+        rc = pread(pump->p_file, buf, len, offset);
+    if (rc <= 0)
+        return rc;
+
+    if (pump->p_flags & PUMP_CHECKSUM)
+        pump->p_crc = crc32c(pump->p_crc, buf, rc);
+
+    if (pump->p_to_file)
+        return pwrite_all(pump->p_file, buf, rc, offset);
+
+    if (write_all(pump->p_pipe, buf, rc) < 0)
+        return -1;
+
+    /* the reader of the second pipe may have given up, or be stuck */
+    if (pump->p_tee >= 0) {
+        int rc2 = pump_tee_write(pump, buf, rc);
+
+        if (rc2) {
+            pho_warn("stopped copying data to the second pipe: %s",
+                     strerror(-rc2));
+            close(pump->p_tee);
+            pump->p_tee = -1;
+        }
+    }
+
+    return rc;
+}
+
+static ssize_t pump_copy_splice(struct pump *pump, size_t len, off_t offset)
+{
+    loff_t off = offset;
+
+    if (pump->p_to_file)
+        return splice(pump->p_pipe, NULL, pump->p_file, &off, len,
+                      SPLICE_F_MOVE);
+
+    return splice(pump->p_file, &off, pump->p_pipe, NULL, len,
+                  SPLICE_F_MOVE);
+}
+
+static int pump_copy(struct pump *pump, char *buf)
+{
+    uint64_t offset;
+    uint64_t length;
+
+    while (pump_range(pump, &offset, &length)) {
+        size_t len = PUMP_CHUNK_SIZE;
+        ssize_t rc;
+
+        if (length < len)
+            len = length;
+
+        if (buf)
+            rc = pump_copy_checksum(pump, buf, len, offset);
+        else
+            rc = pump_copy_splice(pump, len, offset);
+        if (rc < 0 && errno == EINTR)
+            continue;
+
+        if (rc < 0)
+            return -errno;
+
+        if (rc == 0)
+            break;
+
+        pump_advance(pump, rc);
+    }
+
+    return 0;
+}
+
+static int pump_write_file(void *udata, const void *buf, size_t len)
+{
+    struct pump *pump = udata;
+
+    if (pump->p_flags & PUMP_CHECKSUM)
+        pump->p_crc = crc32c(pump->p_crc, buf, len);
+
+    while (len) {
+        uint64_t offset;
+        uint64_t length;
+
+        /* more data than the map describes */
+        if (!pump_range(pump, &offset, &length))
+            return -EIO;
+
+        if (length > len)
+            length = len;
+
+        if (pwrite_all(pump->p_file, buf, length, offset) < 0)
+            return -errno;
+
+        pump_advance(pump, length);
+        buf = (const char *)buf + length;
+        len -= length;
+    }
+
+    return 0;
+}
+
+/* The decompressed data is accounted for as it is written to the file */
+static int pump_copy_decompress(struct pump *pump, struct decompress *dec,
+                                char *buf)
+{
+    while (true) {
+        ssize_t rc;
+
+        rc = read(pump->p_pipe, buf, PUMP_CHUNK_SIZE);
+        if (rc < 0 && errno == EINTR)
+            continue;
+
+        if (rc < 0)
+            return -errno;
+
+        /* truncated compressed data must not go unnoticed */
+        if (rc == 0)
+            return decompress_end(dec);
+
+        rc = decompress_update(dec, buf, rc, pump_write_file, pump);
+        if (rc)
+            return rc;
+    }
+}
+
+static void *pump_thread(void *data)
+{
+    struct pump *pump = data;
+    struct decompress *dec = NULL;
+    uint64_t offset;
+    uint64_t length;
+    char *buf = NULL;
+
+    if (pump->p_flags) {
+        buf = malloc(PUMP_CHUNK_SIZE);
+        if (!buf) {
+            pump->p_rc = -ENOMEM;
+            goto close_pipe;
+        }
+    }
+
+    if (pump->p_flags & PUMP_DECOMPRESS) {
+        pump->p_rc = decompress_new(&dec);
+        if (!pump->p_rc)
+            pump->p_rc = pump_copy_decompress(pump, dec, buf);
+        decompress_free(dec);
+    } else {
+        pump->p_rc = pump_copy(pump, buf);
+    }
+    free(buf);
+
+    if (pump->p_rc || !pump->p_to_file || !pump->p_map)
+        goto close_pipe;
+
+    /* the holes are left unwritten, including at the end of the file */
+    if (pump_range(pump, &offset, &length))
+        pump->p_rc = -EIO;
+    else if (ftruncate(pump->p_file, pump->p_map->sm_size) < 0)
+        pump->p_rc = -errno;
+
+close_pipe:
+    /* let Phobos see the end of the data, or fail if it still writes */
+    close(pump->p_pipe);
+    pump->p_pipe = -1;
+    if (pump->p_tee >= 0) {
+        close(pump->p_tee);
+        pump->p_tee = -1;
+    }
+
+    return NULL;
+}
+
+int pump_start(struct pump *pump, int fd, bool to_file,
+               const struct sparse_map *map, struct throttle *throttle,
+               unsigned int flags)
+{
+    int tee[2] = { -1, -1 };
+    int fds[2];
+    int rc;
+
+    if ((flags & PUMP_DECOMPRESS) && !to_file)
+        return -EINVAL;
+
+    if ((flags & PUMP_TEE) && to_file)
+        return -EINVAL;
+
+    if (pipe2(fds, O_CLOEXEC) < 0)
+        return -errno;
+
+    if ((flags & PUMP_TEE) && pipe2(tee, O_CLOEXEC) < 0) {
+        rc = -errno;
+        close(fds[0]);
+        close(fds[1]);
+        return rc;
+    }
+
+    /* fewer wake-ups, Phobos reads and writes by large blocks */
+    if (fcntl(fds[0], F_SETPIPE_SZ, PUMP_CHUNK_SIZE) < 0)
+        pho_debug("cannot grow pipe buffer: %s", strerror(errno));
+    if (tee[0] >= 0 && fcntl(tee[0], F_SETPIPE_SZ, PUMP_CHUNK_SIZE) < 0)
+        pho_debug("cannot grow pipe buffer: %s", strerror(errno));
+    /* only the end written by the pump, Phobos reads the other as usual */
+    if (tee[1] >= 0 && fcntl(tee[1], F_SETFL, O_NONBLOCK) < 0) {
+        rc = -errno;
+        close(fds[0]);
+        close(fds[1]);
+        close(tee[0]);
+        close(tee[1]);
+        return rc;
+    }
+
+    pump->p_file = fd;
+    pump->p_to_file = to_file;
+    pump->p_pipe = to_file ? fds[0] : fds[1];
+    pump->p_peer = to_file ? fds[1] : fds[0];
+    pump->p_tee = tee[1];
+    pump->p_tee_peer = tee[0];
+    pump->p_map = map;
+    pump->p_extent = 0;
+    pump->p_offset = 0;
+    pump->p_throttle = throttle;
+    pump->p_flags = flags;
+    pump->p_crc = 0;
+    atomic_init(&pump->p_bytes, 0);
+    pump->p_rc = 0;
+
+    rc = pthread_create(&pump->p_thread, NULL, pump_thread, pump);
+    if (rc) {
+        close(fds[0]);
+        close(fds[1]);
+        if (tee[0] >= 0) {
+            close(tee[0]);
+            close(tee[1]);
+        }
+        return -rc;
+    }
+
+    return 0;
+}
+
+int pump_stop(struct pump *pump)
+{
+    close(pump->p_peer);
+    pump->p_peer = -1;
+
+    pthread_join(pump->p_thread, NULL);
+
+    return pump->p_rc;
+}
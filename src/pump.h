@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifndef PUMP_H
+#define PUMP_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sparse.h"
+#include "throttle.h"
+
+enum pump_flags {
+    PUMP_CHECKSUM   = 1 << 0, /* compute the CRC32C of the data copied */
+    PUMP_DECOMPRESS = 1 << 1, /* decompress the zstd data read from the pipe */
+    PUMP_TEE        = 1 << 2, /* copy the data read from the file to a second
+                               * pipe as well
+                               */
+};
+
+/**
+ * Thread copying data between a file and a pipe whose other end is given to
+ * Phobos, so that the bytes transferred can be counted while Phobos reads or
+ * writes them.
+ */
+struct pump {
+    int               p_file;     /* file read or written by the pump */
+    int               p_pipe;     /* end of the pipe used by the pump */
+    int               p_peer;     /* end of the pipe given to Phobos */
+    /* end of the second pipe used by the pump if PUMP_TEE, -1 once the data
+     * is no longer copied to it
+     */
+    int               p_tee;
+    int               p_tee_peer; /* end of the second pipe to read from */
+    bool              p_to_file;  /* true if the data flows to p_file */
+    /* ranges of p_file to copy, NULL to copy up to the end of the data */
+    const struct sparse_map *p_map;
+    size_t            p_extent;   /* extent of p_map being copied */
+    uint64_t          p_offset;   /* offset in that extent, or in p_file */
+    struct throttle  *p_throttle; /* NULL if the copy is not throttled */
+    unsigned int      p_flags;    /* enum pump_flags */
+    uint32_t          p_crc;      /* CRC32C of the data, if PUMP_CHECKSUM */
+    _Atomic uint64_t  p_bytes;    /* number of bytes written to p_file or
+                                   * read from it so far
+                                   */
+    int               p_rc;
+    pthread_t         p_thread;
+};
+
+/**
+ * Start copying data between \p fd and a new pipe.
+ *
+ * @param[out] pump     pump to start
+ * @param[in]  fd       file to read from or to write to
+ * @param[in]  to_file  true if the data read from the pipe is written to
+ *                      \p fd, false if the data read from \p fd is written to
+ *                      the pipe
+ * @param[in]  map      ranges of \p fd to copy, NULL to copy from the start
+ *                      of \p fd up to the end of the data. When writing to
+ *                      \p fd, the holes are left unwritten and \p fd is
+ *                      extended to the size of the map. Must remain valid
+ *                      until pump_stop().
+ * @param[in]  throttle bandwidth limit of the copy, may be NULL
+ * @param[in]  flags    enum pump_flags, the data goes through a buffer
+ *                      instead of being spliced if any is set. The CRC32C
+ *                      is computed on the decompressed data. PUMP_DECOMPRESS
+ *                      requires \p to_file, PUMP_TEE requires it not to be
+ *                      set.
+ *
+ * @return     0 on success, negative POSIX error code on failure
+ */
+int pump_start(struct pump *pump, int fd, bool to_file,
+               const struct sparse_map *map, struct throttle *throttle,
+               unsigned int flags);
+
+/**
+ * End of the pipe to give to Phobos instead of the file.
+ */
+static inline int pump_fd(const struct pump *pump)
+{
+    return pump->p_peer;
+}
+
+/**
+ * End of the second pipe to give to Phobos, if PUMP_TEE. It is closed by the
+ * caller, the pump then stops copying data to it: the copy through the second
+ * pipe fails without failing the copy through the first one. The pump also
+ * stops copying data to it if it is not read for 30 seconds, so that the
+ * first copy never waits for the second one indefinitely.
+ */
+static inline int pump_tee_fd(const struct pump *pump)
+{
+    return pump->p_tee_peer;
+}
+
+/**
+ * Number of bytes read from or written to the file so far, may be called
+ * from any thread.
+ */
+static inline uint64_t pump_bytes(struct pump *pump)
+{
+    return atomic_load(&pump->p_bytes);
+}
+
+/**
+ * Close the end of the pipe given to Phobos and wait for the copy to end.
+ * Data already written to the pipe is still copied to the file.
+ *
+ * @param[in]  pump  pump to stop
+ *
+ * @return     0 if the copy ended successfully, negative POSIX error code
+ *             on failure
+ */
+int pump_stop(struct pump *pump);
+
+#endif
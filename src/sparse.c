@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "sparse.h"
+#include "pho_common.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* skipping a smaller hole costs more than transferring its zeros */
+#define SPARSE_MIN_HOLE (1024 * 1024)
+/* keeps the map small enough for the object metadata */
+#define SPARSE_MAX_EXTENTS 256
+
+static int sparse_map_add(struct sparse_map *map, size_t *capacity,
+                          uint64_t offset, uint64_t length)
+{
+    if (map->sm_count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 16;
+        struct extent *tmp;
+
+        tmp = realloc(map->sm_extents, new_capacity * sizeof(*tmp));
+        if (!tmp)
+            return -ENOMEM;
+
+        map->sm_extents = tmp;
+        *capacity = new_capacity;
+    }
+
+    map->sm_extents[map->sm_count].e_offset = offset;
+    map->sm_extents[map->sm_count].e_length = length;
+    map->sm_count++;
+
+    return 0;
+}
+
+/* Count the holes smaller than \p min_hole as data */
+static void sparse_map_merge(struct sparse_map *map, uint64_t min_hole)
+{
+    struct extent *extents = map->sm_extents;
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; i < map->sm_count; i++) {
+        struct extent *last = count ? &extents[count - 1] : NULL;
+
+        if (!last && extents[i].e_offset < min_hole) {
+            extents[i].e_length += extents[i].e_offset;
+            extents[i].e_offset = 0;
+        }
+
+        if (last &&
+            extents[i].e_offset - (last->e_offset + last->e_length) <
+                min_hole) {
+            last->e_length = extents[i].e_offset + extents[i].e_length -
+                             last->e_offset;
+            continue;
+        }
+
+        extents[count++] = extents[i];
+    }
+
+    map->sm_count = count;
+}
+
+int sparse_map_build(int fd, uint64_t size, struct sparse_map *map)
+{
+    uint64_t min_hole = SPARSE_MIN_HOLE;
+    size_t capacity = 0;
+    uint64_t offset = 0;
+    int rc = 0;
+
+    memset(map, 0, sizeof(*map));
+    map->sm_size = size;
+
+    while (offset < size) {
+        off_t data;
+        off_t hole;
+
+        data = lseek(fd, offset, SEEK_DATA);
+        /* nothing but a hole up to the end of the file */
+        if (data < 0 && errno == ENXIO)
+            break;
+        if (data < 0) {
+            rc = -errno;
+            goto fallback;
+        }
+        if ((uint64_t)data >= size)
+            break;
+
+        hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0) {
+            rc = -errno;
+            goto fallback;
+        }
+        if ((uint64_t)hole > size)
+            hole = size;
+
+        rc = sparse_map_add(map, &capacity, data, hole - data);
+        if (rc)
+            goto fallback;
+
+        offset = hole;
+    }
+
+    do {
+        sparse_map_merge(map, min_hole);
+        min_hole *= 2;
+    } while (map->sm_count > SPARSE_MAX_EXTENTS);
+
+    if (lseek(fd, 0, SEEK_SET) < 0) {
+        rc = -errno;
+        sparse_map_fini(map);
+        return rc;
+    }
+
+    return 0;
+
+fallback:
+    pho_verb("cannot map the holes of the file, rc=%d: %s", rc,
+             strerror(-rc));
+    sparse_map_fini(map);
+    if (lseek(fd, 0, SEEK_SET) < 0)
+        return -errno;
+
+    return sparse_map_dense(size, map);
+}
+
+int sparse_map_dense(uint64_t size, struct sparse_map *map)
+{
+    size_t capacity = 0;
+
+    memset(map, 0, sizeof(*map));
+    map->sm_size = size;
+
+    return sparse_map_add(map, &capacity, 0, size);
+}
+
+int sparse_map_split(uint64_t size, size_t count, uint64_t align,
+                     struct sparse_map *map)
+{
+    size_t capacity = 0;
+    uint64_t length;
+    uint64_t offset;
+    int rc;
+
+    if (count == 0 || align == 0)
+        return -EINVAL;
+
+    memset(map, 0, sizeof(*map));
+    map->sm_size = size;
+
+    length = size / count + (size % count != 0);
+    length = (length + align - 1) / align * align;
+
+    for (offset = 0; offset < size; offset += length) {
+        rc = sparse_map_add(map, &capacity, offset,
+                            size - offset < length ? size - offset : length);
+        if (rc) {
+            sparse_map_fini(map);
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+bool sparse_map_is_dense(const struct sparse_map *map)
+{
+    if (map->sm_size == 0)
+        return true;
+
+    return map->sm_count == 1 && map->sm_extents[0].e_offset == 0 &&
+           map->sm_extents[0].e_length == map->sm_size;
+}
+
+uint64_t sparse_map_data_size(const struct sparse_map *map)
+{
+    uint64_t size = 0;
+    size_t i;
+
+    for (i = 0; i < map->sm_count; i++)
+        size += map->sm_extents[i].e_length;
+
+    return size;
+}
+
+int sparse_map2str(const struct sparse_map *map, char **str)
+{
+    size_t len;
+    FILE *out;
+    size_t i;
+
+    out = open_memstream(str, &len);
+    if (!out)
+        return -ENOMEM;
+
+    for (i = 0; i < map->sm_count; i++)
+        fprintf(out, "%s%ju+%ju", i ? "," : "",
+                (uintmax_t)map->sm_extents[i].e_offset,
+                (uintmax_t)map->sm_extents[i].e_length);
+
+    if (fclose(out)) {
+        free(*str);
+        *str = NULL;
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+int str2sparse_map(const char *str, uint64_t size, struct sparse_map *map)
+{
+    size_t capacity = 0;
+    uint64_t end = 0;
+    const char *cur;
+    int rc;
+
+    memset(map, 0, sizeof(*map));
+    map->sm_size = size;
+
+    for (cur = str; *cur; ) {
+        unsigned long long offset;
+        unsigned long long length;
+        char *next;
+
+        errno = 0;
+        offset = strtoull(cur, &next, 10);
+        if (errno || next == cur || *next != '+')
+            goto invalid;
+
+        cur = next + 1;
+        length = strtoull(cur, &next, 10);
+        if (errno || next == cur || (*next != ',' && *next != '\0') ||
+            (*next == ',' && next[1] == '\0'))
+            goto invalid;
+
+        if (length == 0 || offset < end || offset > size ||
+            length > size - offset)
+            goto invalid;
+
+        rc = sparse_map_add(map, &capacity, offset, length);
+        if (rc) {
+            sparse_map_fini(map);
+            return rc;
+        }
+
+        end = offset + length;
+        cur = *next ? next + 1 : next;
+    }
+
+    return 0;
+
+invalid:
+    sparse_map_fini(map);
+
+    return -EINVAL;
+}
+
+void sparse_map_fini(struct sparse_map *map)
+{
+    free(map->sm_extents);
+    map->sm_extents = NULL;
+    map->sm_count = 0;
+}
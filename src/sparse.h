@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct extent {
+    uint64_t e_offset;
+    uint64_t e_length;
+};
+
+/* Data regions of a file, sorted and not overlapping. Everything else is a
+ * hole.
+ */
+struct sparse_map {
+    uint64_t        sm_size;    /* size of the file */
+    size_t          sm_count;
+    struct extent  *sm_extents;
+};
+
+/**
+ * Map the data regions of \p fd with SEEK_DATA/SEEK_HOLE. Holes too small to
+ * be worth skipping are counted as data. The offset of \p fd is reset to 0.
+ *
+ * @param[in]  fd    file to map
+ * @param[in]  size  size of the file
+ * @param[out] map   data regions of the file, to be freed with
+ *                   sparse_map_fini()
+ *
+ * @return     0 on success, negative POSIX error code on failure
+ */
+int sparse_map_build(int fd, uint64_t size, struct sparse_map *map);
+
+/**
+ * Describe a whole file as a single data region.
+ *
+ * @return     0 on success, -ENOMEM on failure
+ */
+int sparse_map_dense(uint64_t size, struct sparse_map *map);
+
+/**
+ * Split a whole file into at most \p count contiguous ranges of the same
+ * size, except for the last one.
+ *
+ * @param[in]  size   size of the file
+ * @param[in]  count  maximum number of ranges
+ * @param[in]  align  alignment of the ranges
+ * @param[out] map    ranges of the file, to be freed with sparse_map_fini()
+ *
+ * @return     0 on success, -EINVAL if \p count or \p align is 0, -ENOMEM
+ */
+int sparse_map_split(uint64_t size, size_t count, uint64_t align,
+                     struct sparse_map *map);
+
+/**
+ * @return     true if \p map has no hole
+ */
+bool sparse_map_is_dense(const struct sparse_map *map);
+
+/**
+ * @return     number of bytes of the data regions of \p map
+ */
+uint64_t sparse_map_data_size(const struct sparse_map *map);
+
+/**
+ * Encode the data regions of \p map as "offset+length,...".
+ *
+ * @param[in]  map  map to encode
+ * @param[out] str  allocated string, to be freed by the caller
+ *
+ * @return     0 on success, -ENOMEM on failure
+ */
+int sparse_map2str(const struct sparse_map *map, char **str);
+
+/**
+ * Decode the data regions encoded by sparse_map2str().
+ *
+ * @param[in]  str   encoded data regions
+ * @param[in]  size  size of the file
+ * @param[out] map   decoded map, to be freed with sparse_map_fini()
+ *
+ * @return     0 on success, -EINVAL if \p str is invalid, -ENOMEM
+ */
+int str2sparse_map(const char *str, uint64_t size, struct sparse_map *map);
+
+void sparse_map_fini(struct sparse_map *map);
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "throttle.h"
+
+#include <errno.h>
+#include <time.h>
+
+static double throttle_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + 0.000000001 * now.tv_nsec;
+}
+
+/* Called with the lock held */
+static void throttle_refill(struct throttle *throttle, double now)
+{
+    throttle->t_tokens += (now - throttle->t_last) * throttle->t_rate;
+    if (throttle->t_tokens > throttle->t_rate)
+        throttle->t_tokens = throttle->t_rate;
+    throttle->t_last = now;
+}
+
+void throttle_init(struct throttle *throttle, uint64_t rate,
+                   struct throttle *parent)
+{
+    pthread_mutex_init(&throttle->t_lock, NULL);
+    throttle->t_rate = rate;
+    throttle->t_tokens = rate;
+    throttle->t_last = throttle_now();
+    throttle->t_parent = parent;
+}
+
+void throttle_set_rate(struct throttle *throttle, uint64_t rate)
+{
+    pthread_mutex_lock(&throttle->t_lock);
+    throttle_refill(throttle, throttle_now());
+    /* a bucket which was unlimited starts full */
+    if (!throttle->t_rate)
+        throttle->t_tokens = rate;
+    throttle->t_rate = rate;
+    if (throttle->t_tokens > rate)
+        throttle->t_tokens = rate;
+    pthread_mutex_unlock(&throttle->t_lock);
+}
+
+double throttle_reserve(struct throttle *throttle, size_t bytes)
+{
+    double wait = 0;
+
+    for (; throttle; throttle = throttle->t_parent) {
+        double now = throttle_now();
+
+        pthread_mutex_lock(&throttle->t_lock);
+        if (throttle->t_rate) {
+            throttle_refill(throttle, now);
+            throttle->t_tokens -= bytes;
+            if (throttle->t_tokens < 0 &&
+                -throttle->t_tokens / throttle->t_rate > wait)
+                wait = -throttle->t_tokens / throttle->t_rate;
+        }
+        pthread_mutex_unlock(&throttle->t_lock);
+    }
+
+    return wait;
+}
+
+void throttle_acquire(struct throttle *throttle, size_t bytes)
+{
+    double wait = throttle_reserve(throttle, bytes);
+    struct timespec delay;
+
+    if (wait <= 0)
+        return;
+
+    delay.tv_sec = wait;
+    delay.tv_nsec = (wait - delay.tv_sec) * 1000000000L;
+    while (nanosleep(&delay, &delay) < 0 && errno == EINTR)
+        ;
+}
+
+void throttle_fini(struct throttle *throttle)
+{
+    pthread_mutex_destroy(&throttle->t_lock);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Token bucket shared by several data streams. The bucket holds at most one
+ * second worth of tokens. A stream taking more tokens than available goes
+ * into debt and waits for the debt to be repaid, so that the streams are
+ * served in the order they asked.
+ *
+ * If t_parent is set, the streams are also limited by the parent bucket.
+ */
+struct throttle {
+    pthread_mutex_t  t_lock;
+    uint64_t         t_rate;    /* bytes per second, 0 if unlimited */
+    double           t_tokens;  /* bytes, negative when in debt */
+    double           t_last;    /* time of the last refill */
+    struct throttle *t_parent;
+};
+
+/**
+ * @param[out] throttle  bucket to initialize
+ * @param[in]  rate      bytes per second, 0 if unlimited
+ * @param[in]  parent    bucket also limiting the streams, may be NULL
+ */
+void throttle_init(struct throttle *throttle, uint64_t rate,
+                   struct throttle *parent);
+
+/**
+ * Change the rate of \p throttle, may be called while streams use it.
+ */
+void throttle_set_rate(struct throttle *throttle, uint64_t rate);
+
+/**
+ * Take \p bytes tokens from \p throttle and its parents.
+ *
+ * @return     number of seconds to wait before sending \p bytes
+ */
+double throttle_reserve(struct throttle *throttle, size_t bytes);
+
+/**
+ * Take \p bytes tokens from \p throttle and its parents and wait for them
+ * to be available.
+ */
+void throttle_acquire(struct throttle *throttle, size_t bytes);
+
+void throttle_fini(struct throttle *throttle);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "uid_cache.h"
+
+#include <errno.h>
+#include <pwd.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct uid_entry {
+    time_t  ue_expire;
+    char   *ue_name;    /* NULL if the uid has no name */
+    int     ue_rc;      /* error of the lookup if ue_name is NULL */
+};
+
+static time_t uid_cache_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec;
+}
+
+static void uid_entry_free(gpointer data)
+{
+    struct uid_entry *entry = data;
+
+    free(entry->ue_name);
+    free(entry);
+}
+
+void uid_cache_init(struct uid_cache *cache, time_t ttl, time_t negative_ttl)
+{
+    pthread_mutex_init(&cache->uc_lock, NULL);
+    cache->uc_table = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                            NULL, uid_entry_free);
+    cache->uc_ttl = ttl;
+    cache->uc_negative_ttl = negative_ttl;
+}
+
+/* Ask the directory service for the name of \p uid */
+static int uid_lookup(uid_t uid, char **name)
+{
+    struct passwd pwd_, *pwd = NULL;
+    size_t buflen;
+    char *buf;
+    int rc;
+
+    buflen = sysconf(_SC_GETPW_R_SIZE_MAX);
+    /* should never happen but technically allowed... */
+    if ((long)buflen < 0)
+        buflen = 1024;
+
+    while (true) {
+        buf = malloc(buflen);
+        if (!buf)
+            return -ENOMEM;
+
+        rc = getpwuid_r(uid, &pwd_, buf, buflen, &pwd);
+        if (rc != ERANGE)
+            break;
+
+        free(buf);
+        buflen *= 2;
+    }
+
+    if (rc) {
+        free(buf);
+        return -rc;
+    }
+
+    /* pwd is NULL if there is no such user */
+    *name = pwd ? strdup(pwd->pw_name) : NULL;
+    free(buf);
+    if (!pwd)
+        return -ENOENT;
+
+    return *name ? 0 : -ENOMEM;
+}
+
+/* Copy the outcome of the lookup cached in \p entry, called with the lock
+ * held.
+ */
+static int uid_entry_get(const struct uid_entry *entry, char **name)
+{
+    if (!entry->ue_name)
+        return entry->ue_rc;
+
+    *name = strdup(entry->ue_name);
+
+    return *name ? 0 : -ENOMEM;
+}
+
+int uid_cache_get(struct uid_cache *cache, uid_t uid, char **name)
+{
+    gpointer key = GUINT_TO_POINTER(uid);
+    struct uid_entry *entry;
+    char *found = NULL;
+    time_t now;
+    int rc;
+
+    *name = NULL;
+
+    pthread_mutex_lock(&cache->uc_lock);
+    now = uid_cache_now();
+    entry = g_hash_table_lookup(cache->uc_table, key);
+    if (entry && entry->ue_expire > now) {
+        rc = uid_entry_get(entry, name);
+        pthread_mutex_unlock(&cache->uc_lock);
+        return rc;
+    }
+    pthread_mutex_unlock(&cache->uc_lock);
+
+    /* the directory service may be slow, other uids must not wait for it */
+    rc = uid_lookup(uid, &found);
+    if (rc == -ENOMEM)
+        return rc;
+
+    pthread_mutex_lock(&cache->uc_lock);
+    now = uid_cache_now();
+    entry = g_hash_table_lookup(cache->uc_table, key);
+    if (rc && rc != -ENOENT && entry && entry->ue_name) {
+        /* keep the last known name while the directory service fails */
+        entry->ue_expire = now + cache->uc_negative_ttl;
+    } else {
+        if (!entry) {
+            entry = calloc(1, sizeof(*entry));
+            if (!entry) {
+                pthread_mutex_unlock(&cache->uc_lock);
+                free(found);
+                return -ENOMEM;
+            }
+            g_hash_table_insert(cache->uc_table, key, entry);
+        }
+
+        free(entry->ue_name);
+        entry->ue_name = found;
+        entry->ue_rc = rc;
+        entry->ue_expire = now + (found ? cache->uc_ttl :
+                                  cache->uc_negative_ttl);
+    }
+    rc = uid_entry_get(entry, name);
+    pthread_mutex_unlock(&cache->uc_lock);
+
+    return rc;
+}
+
+void uid_cache_fini(struct uid_cache *cache)
+{
+    if (!cache->uc_table)
+        return;
+
+    g_hash_table_destroy(cache->uc_table);
+    cache->uc_table = NULL;
+    pthread_mutex_destroy(&cache->uc_lock);
+}
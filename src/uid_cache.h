@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifndef UID_CACHE_H
+#define UID_CACHE_H
+
+#include <glib.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+
+/**
+ * User name of each uid, as returned by getpwuid_r(). Names are kept for
+ * uc_ttl seconds, and the uids without a name for uc_negative_ttl seconds, so
+ * that a slow directory service is only asked once in a while.
+ */
+struct uid_cache {
+    pthread_mutex_t  uc_lock;
+    GHashTable      *uc_table;         /* uid -> struct uid_entry */
+    time_t           uc_ttl;
+    time_t           uc_negative_ttl;
+};
+
+/**
+ * @param[out] cache         cache to initialize
+ * @param[in]  ttl           seconds a name is kept
+ * @param[in]  negative_ttl  seconds a failed lookup is kept
+ */
+void uid_cache_init(struct uid_cache *cache, time_t ttl, time_t negative_ttl);
+
+/**
+ * Get the user name of \p uid. The lookup is done without holding the lock of
+ * the cache. If it fails, the expired name of \p uid is used if any.
+ *
+ * @param[in]  cache  cache of the names
+ * @param[in]  uid    uid to look up
+ * @param[out] name   user name of \p uid, to be freed by the caller
+ *
+ * @return     0 on success, -ENOENT if \p uid has no name, negative POSIX
+ *             error code if the lookup failed
+ */
+int uid_cache_get(struct uid_cache *cache, uid_t uid, char **name);
+
+/* May be called on a zeroed cache which was never initialized */
+void uid_cache_fini(struct uid_cache *cache);
+
+#endif
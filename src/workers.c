@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "workers.h"
+#include "pho_common.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+static bool lane_is_ready(struct worker_pool *pool, struct worker_lane *lane)
+{
+    unsigned int max_running = lane->wl_max_running ? : pool->wp_nb_workers;
+
+    return !g_queue_is_empty(&lane->wl_jobs) &&
+        lane->wl_running < max_running;
+}
+
+/* Smooth weighted round robin: every ready lane earns its weight in credits,
+ * the richest lane is picked and pays back the sum of the weights.
+ */
+static struct worker_lane *pick_lane(struct worker_pool *pool)
+{
+    struct worker_lane *best = NULL;
+    unsigned int i;
+    int total = 0;
+
+    for (i = 0; i < pool->wp_nb_lanes; i++) {
+        struct worker_lane *lane = &pool->wp_lanes[i];
+
+        if (!lane_is_ready(pool, lane))
+            continue;
+
+        lane->wl_credit += lane->wl_weight;
+        total += lane->wl_weight;
+        if (!best || lane->wl_credit > best->wl_credit)
+            best = lane;
+    }
+
+    if (best)
+        best->wl_credit -= total;
+
+    return best;
+}
+
+static bool pool_is_empty(struct worker_pool *pool)
+{
+    unsigned int i;
+
+    for (i = 0; i < pool->wp_nb_lanes; i++)
+        if (!g_queue_is_empty(&pool->wp_lanes[i].wl_jobs) ||
+            !g_queue_is_empty(&pool->wp_lanes[i].wl_parked))
+            return false;
+
+    return true;
+}
+
+/* Called with the pool lock held, once jobs were dequeued from \p lane */
+static void unpark_jobs(struct worker_lane *lane)
+{
+    while (!g_queue_is_empty(&lane->wl_parked) &&
+           g_queue_get_length(&lane->wl_jobs) < lane->wl_queue_size)
+        g_queue_push_tail(&lane->wl_jobs, g_queue_pop_head(&lane->wl_parked));
+}
+
+/* Move the jobs of \p lane compatible with \p batch[0] to \p batch */
+static size_t take_compatible(struct worker_lane *lane, void **batch,
+                              size_t count)
+{
+    GList *link = lane->wl_jobs.head;
+    size_t taken = 0;
+
+    while (link && count + taken < lane->wl_batch_size) {
+        GList *next = link->next;
+
+        if (!lane->wl_compat || lane->wl_compat(batch[0], link->data)) {
+            batch[count + taken++] = link->data;
+            g_queue_delete_link(&lane->wl_jobs, link);
+        }
+        link = next;
+    }
+
+    return taken;
+}
+
+/* Called with the pool lock held, batch[0] already popped from \p lane */
+static size_t fill_batch(struct worker_pool *pool, struct worker_lane *lane,
+                         void **batch)
+{
+    struct timespec deadline;
+    size_t count = 1;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += lane->wl_batch_delay_ms / 1000;
+    deadline.tv_nsec += (lane->wl_batch_delay_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    while (true) {
+        int rc;
+
+        count += take_compatible(lane, batch, count);
+        /* the parked jobs may join the batch */
+        unpark_jobs(lane);
+        if (count == lane->wl_batch_size || pool->wp_stopping)
+            break;
+
+        rc = pthread_cond_timedwait(&pool->wp_ready, &pool->wp_lock,
+                                    &deadline);
+        if (rc == ETIMEDOUT) {
+            count += take_compatible(lane, batch, count);
+            break;
+        }
+    }
+
+    return count;
+}
+
+static void *worker_thread(void *data)
+{
+    struct worker_pool *pool = data;
+    size_t max_batch = 1;
+    void **batch;
+    unsigned int i;
+
+    for (i = 0; i < pool->wp_nb_lanes; i++)
+        if (pool->wp_lanes[i].wl_batch_size > max_batch)
+            max_batch = pool->wp_lanes[i].wl_batch_size;
+
+    batch = malloc(max_batch * sizeof(*batch));
+    if (!batch) {
+        pho_error(-errno, "cannot allocate worker batch");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->wp_lock);
+    while (true) {
+        struct worker_lane *lane;
+        size_t count = 1;
+
+        lane = pick_lane(pool);
+        if (!lane) {
+            /* the lanes are drained before stopping */
+            if (pool->wp_stopping && pool_is_empty(pool))
+                break;
+
+            pthread_cond_wait(&pool->wp_ready, &pool->wp_lock);
+            continue;
+        }
+
+        batch[0] = g_queue_pop_head(&lane->wl_jobs);
+        lane->wl_running++;
+        if (lane->wl_batch_size > 1)
+            count = fill_batch(pool, lane, batch);
+        unpark_jobs(lane);
+        pthread_mutex_unlock(&pool->wp_lock);
+
+        pool->wp_fn(batch, count);
+
+        pthread_mutex_lock(&pool->wp_lock);
+        lane->wl_running--;
+        /* the lane may have been capped, let another worker serve it */
+        pthread_cond_broadcast(&pool->wp_ready);
+    }
+    pthread_mutex_unlock(&pool->wp_lock);
+    free(batch);
+
+    return NULL;
+}
+
+int worker_pool_init(struct worker_pool *pool, unsigned int nb_workers,
+                     struct worker_lane *lanes, unsigned int nb_lanes,
+                     worker_fn_t fn)
+{
+    unsigned int i;
+    int rc;
+
+    if (nb_workers == 0 || nb_lanes == 0)
+        return -EINVAL;
+
+    for (i = 0; i < nb_lanes; i++) {
+        if (lanes[i].wl_queue_size == 0 || lanes[i].wl_weight <= 0)
+            return -EINVAL;
+
+        /* a batch must be able to fill up */
+        if (lanes[i].wl_queue_size < lanes[i].wl_batch_size)
+            lanes[i].wl_queue_size = lanes[i].wl_batch_size;
+
+        g_queue_init(&lanes[i].wl_jobs);
+        g_queue_init(&lanes[i].wl_parked);
+        lanes[i].wl_running = 0;
+        lanes[i].wl_credit = 0;
+    }
+
+    pool->wp_workers = calloc(nb_workers, sizeof(*pool->wp_workers));
+    if (!pool->wp_workers)
+        return -errno;
+
+    pthread_mutex_init(&pool->wp_lock, NULL);
+    pthread_cond_init(&pool->wp_ready, NULL);
+    pool->wp_lanes = lanes;
+    pool->wp_nb_lanes = nb_lanes;
+    pool->wp_nb_workers = 0;
+    pool->wp_fn = fn;
+    pool->wp_stopping = false;
+
+    pthread_mutex_lock(&pool->wp_lock);
+    for (i = 0; i < nb_workers; i++) {
+        rc = pthread_create(&pool->wp_workers[i], NULL, worker_thread, pool);
+        if (rc) {
+            pthread_mutex_unlock(&pool->wp_lock);
+            pho_error(-rc, "cannot create worker thread #%u", i);
+            worker_pool_fini(pool);
+            return -rc;
+        }
+        pool->wp_nb_workers++;
+    }
+    pthread_mutex_unlock(&pool->wp_lock);
+
+    for (i = 0; i < nb_lanes; i++)
+        pho_verb("lane '%s': max running %u, queue size %u, weight %d, "
+                 "batch size %u", lanes[i].wl_name,
+                 lanes[i].wl_max_running ? : pool->wp_nb_workers,
+                 lanes[i].wl_queue_size, lanes[i].wl_weight,
+                 lanes[i].wl_batch_size ? : 1);
+
+    return 0;
+}
+
+int worker_pool_push(struct worker_pool *pool, unsigned int lane, void *job)
+{
+    struct worker_lane *wl;
+
+    if (lane >= pool->wp_nb_lanes)
+        return -EINVAL;
+
+    wl = &pool->wp_lanes[lane];
+
+    pthread_mutex_lock(&pool->wp_lock);
+    if (pool->wp_stopping) {
+        pthread_mutex_unlock(&pool->wp_lock);
+        return -ESHUTDOWN;
+    }
+
+    if (g_queue_get_length(&wl->wl_jobs) >= wl->wl_queue_size ||
+        !g_queue_is_empty(&wl->wl_parked)) {
+        g_queue_push_tail(&wl->wl_parked, job);
+    } else {
+        g_queue_push_tail(&wl->wl_jobs, job);
+        pthread_cond_broadcast(&pool->wp_ready);
+    }
+    pthread_mutex_unlock(&pool->wp_lock);
+
+    return 0;
+}
+
+int worker_pool_remove(struct worker_pool *pool, unsigned int lane, void *job)
+{
+    struct worker_lane *wl;
+    bool removed;
+
+    if (lane >= pool->wp_nb_lanes)
+        return -EINVAL;
+
+    wl = &pool->wp_lanes[lane];
+
+    pthread_mutex_lock(&pool->wp_lock);
+    removed = g_queue_remove(&wl->wl_parked, job);
+    if (!removed) {
+        removed = g_queue_remove(&wl->wl_jobs, job);
+        unpark_jobs(wl);
+    }
+    pthread_mutex_unlock(&pool->wp_lock);
+
+    return removed ? 0 : -ENOENT;
+}
+
+void worker_pool_fini(struct worker_pool *pool)
+{
+    unsigned int i;
+
+    pthread_mutex_lock(&pool->wp_lock);
+    pool->wp_stopping = true;
+    pthread_cond_broadcast(&pool->wp_ready);
+    pthread_mutex_unlock(&pool->wp_lock);
+
+    for (i = 0; i < pool->wp_nb_workers; i++)
+        pthread_join(pool->wp_workers[i], NULL);
+
+    free(pool->wp_workers);
+    pool->wp_workers = NULL;
+    pool->wp_nb_workers = 0;
+    pthread_cond_destroy(&pool->wp_ready);
+    pthread_mutex_destroy(&pool->wp_lock);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2026 Commissariat a l'energie atomique et aux energies
+ *                    alternatives
+ *
+ * SPDX-License-Identifer: GPL-2.0-only
+ */
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <glib.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+/**
+ * Function called by a worker thread for each batch of jobs popped from a
+ * lane. The function takes ownership of the jobs but not of the array.
+ */
+typedef void (*worker_fn_t)(void **jobs, size_t count);
+
+/**
+ * Tell whether \p job can be processed in the same batch as \p first.
+ */
+typedef bool (*worker_compat_fn_t)(const void *first, const void *job);
+
+/**
+ * Bounded FIFO queue of jobs sharing the same concurrency limit. The jobs
+ * pushed while it is full are parked, without bound, until there is room.
+ *
+ * Lanes are served by the workers in a weighted round robin fashion: when
+ * several lanes have jobs ready, a lane of weight 2 is picked twice as often
+ * as a lane of weight 1.
+ *
+ * If wl_batch_size is greater than 1, a worker picking a job from the lane
+ * also picks up to wl_batch_size - 1 compatible jobs, waiting at most
+ * wl_batch_delay_ms for them to be queued. A batch counts as one running job.
+ */
+struct worker_lane {
+    const char      *wl_name;
+    unsigned int     wl_queue_size;  /* maximum number of queued jobs */
+    unsigned int     wl_max_running; /* 0 means as many as there are workers */
+    int              wl_weight;
+    unsigned int     wl_batch_size;
+    unsigned int     wl_batch_delay_ms;
+    worker_compat_fn_t wl_compat;    /* NULL if every job is compatible */
+    /* internal state */
+    GQueue           wl_jobs;
+    GQueue           wl_parked;      /* jobs waiting for room in wl_jobs */
+    unsigned int     wl_running;
+    int              wl_credit;
+};
+
+/**
+ * Fixed set of threads consuming jobs from a set of lanes.
+ */
+struct worker_pool {
+    pthread_mutex_t     wp_lock;
+    pthread_cond_t      wp_ready;     /* a job was queued or a job ended */
+    struct worker_lane *wp_lanes;
+    unsigned int        wp_nb_lanes;
+    unsigned int        wp_nb_workers;
+    pthread_t          *wp_workers;
+    worker_fn_t         wp_fn;
+    bool                wp_stopping;
+};
+
+/**
+ * Start \p nb_workers threads which will call \p fn on each queued job.
+ *
+ * @param[out] pool        pool to initialize
+ * @param[in]  nb_workers  number of threads to start
+ * @param[in]  lanes       lanes served by the workers, the pool keeps a
+ *                         reference on this array
+ * @param[in]  nb_lanes    number of elements of \p lanes
+ * @param[in]  fn          function called on each job
+ *
+ * @return     0 on success, negative POSIX error code on failure
+ */
+int worker_pool_init(struct worker_pool *pool, unsigned int nb_workers,
+                     struct worker_lane *lanes, unsigned int nb_lanes,
+                     worker_fn_t fn);
+
+/**
+ * Queue a job on a lane without waiting. If the lane is full, the job is
+ * parked and queued, in order, as soon as a worker dequeues a job from it.
+ * Parked jobs are not bounded.
+ *
+ * @param[in]  pool  pool to queue \p job to
+ * @param[in]  lane  index of the lane in the pool
+ * @param[in]  job   job given to the worker function
+ *
+ * @return     0 on success, -ESHUTDOWN if the pool is being stopped
+ */
+int worker_pool_push(struct worker_pool *pool, unsigned int lane, void *job);
+
+/**
+ * Remove a job from a lane, queued or parked, before any worker picks it up.
+ *
+ * @param[in]  pool  pool \p job was queued to
+ * @param[in]  lane  index of the lane in the pool
+ * @param[in]  job   job to remove
+ *
+ * @return     0 on success, -ENOENT if \p job is no longer queued
+ */
+int worker_pool_remove(struct worker_pool *pool, unsigned int lane, void *job);
+
+/**
+ * Wait for every queued job to be processed and stop the workers.
+ *
+ * @param[in]  pool  pool to stop
+ */
+void worker_pool_fini(struct worker_pool *pool);
+
+#endif
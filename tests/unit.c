@@ -5,10 +5,21 @@
 #include <stddef.h>
 #include <cmocka.h>
 
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "checksum.h"
 #include "common.h"
+#include "compress.h"
+#include "fid_cache.h"
+#include "layout.h"
+#include "mdt_cache.h"
+#include "pack.h"
 #include "pho_common.h"
+#include "sparse.h"
+#include "throttle.h"
+#include "uid_cache.h"
 
 struct test_input {
     const char *input;
@@ -186,12 +197,437 @@ static void test_process_hints(void **data)
     }
 }
 
+static void test_throttle(void **data)
+{
+    struct throttle parent;
+    struct throttle child;
+    double wait;
+
+    (void) data;
+
+    throttle_init(&parent, 0, NULL);
+    throttle_init(&child, 0, &parent);
+
+    /* unlimited */
+    assert_true(throttle_reserve(&child, 1 << 30) == 0);
+
+    /* the bucket starts full with one second worth of tokens */
+    throttle_set_rate(&parent, 1000);
+    assert_true(throttle_reserve(&child, 1000) == 0);
+
+    /* then the stream goes into debt */
+    wait = throttle_reserve(&child, 1000);
+    assert_true(wait > 0.9 && wait <= 1.0);
+
+    /* the most limiting bucket wins */
+    throttle_set_rate(&child, 100);
+    wait = throttle_reserve(&child, 400);
+    assert_true(wait > 2.9 && wait <= 3.0);
+
+    throttle_fini(&child);
+    throttle_fini(&parent);
+}
+
+static void test_crc32c(void **data)
+{
+    const char *check = "123456789";
+    char buf[4099];
+    uint32_t crc;
+    size_t i;
+
+    (void) data;
+
+    /* reference value of the CRC-32C catalogue */
+    assert_int_equal(0xe3069283, crc32c(0, check, strlen(check)));
+    assert_int_equal(0, crc32c(0, NULL, 0));
+
+    /* unaligned buffer, updated in several parts */
+    for (i = 0; i < sizeof(buf); i++)
+        buf[i] = i * 7;
+
+    crc = crc32c(0, buf + 1, 1000);
+    crc = crc32c(crc, buf + 1001, sizeof(buf) - 1001);
+    assert_int_equal(crc32c(0, buf + 1, sizeof(buf) - 1), crc);
+
+    /* parts checksummed separately */
+    crc = crc32c_combine(crc32c(0, buf, 1000),
+                         crc32c(0, buf + 1000, sizeof(buf) - 1000),
+                         sizeof(buf) - 1000);
+    assert_int_equal(crc32c(0, buf, sizeof(buf)), crc);
+    assert_int_equal(crc, crc32c_combine(crc, 0, 0));
+}
+
+static void test_compress_parse(void **data)
+{
+    int level;
+
+    (void) data;
+
+    assert_int_equal(-EINVAL, compress_parse("gzip", &level));
+    assert_int_equal(-EINVAL, compress_parse("zstdx", &level));
+#ifdef HAVE_ZSTD
+    assert_int_equal(0, compress_parse("zstd", &level));
+    assert_int_equal(0, level);
+    assert_int_equal(0, compress_parse("zstd:19", &level));
+    assert_int_equal(19, level);
+    assert_int_equal(-EINVAL, compress_parse("zstd:", &level));
+    assert_int_equal(-EINVAL, compress_parse("zstd:fast", &level));
+    assert_int_equal(-EINVAL, compress_parse("zstd:1000", &level));
+#else
+    assert_int_equal(-ENOTSUP, compress_parse("zstd:3", &level));
+#endif
+}
+
+static void test_sparse_map(void **data)
+{
+    const char *extents = "0+4096,1048576+10";
+    struct sparse_map map;
+    char *str;
+
+    (void) data;
+
+    assert_int_equal(0, str2sparse_map(extents, 2097152, &map));
+    assert_int_equal(2, map.sm_count);
+    assert_int_equal(4106, sparse_map_data_size(&map));
+    assert_false(sparse_map_is_dense(&map));
+
+    assert_int_equal(0, sparse_map2str(&map, &str));
+    assert_string_equal(extents, str);
+    free(str);
+    sparse_map_fini(&map);
+
+    /* overlapping, out of the file, empty, or truncated extents */
+    assert_int_equal(-EINVAL, str2sparse_map("10+10,15+10", 100, &map));
+    assert_int_equal(-EINVAL, str2sparse_map("90+20", 100, &map));
+    assert_int_equal(-EINVAL, str2sparse_map("10+0", 100, &map));
+    assert_int_equal(-EINVAL, str2sparse_map("10+10,", 100, &map));
+    assert_int_equal(-EINVAL, str2sparse_map("10", 100, &map));
+
+    assert_int_equal(0, sparse_map_dense(100, &map));
+    assert_true(sparse_map_is_dense(&map));
+    assert_int_equal(100, sparse_map_data_size(&map));
+    sparse_map_fini(&map);
+
+    /* aligned ranges, fewer than asked for if the file is small */
+    assert_int_equal(0, sparse_map_split(10 * 1048576 + 1, 4, 1048576, &map));
+    assert_int_equal(0, sparse_map2str(&map, &str));
+    assert_string_equal("0+3145728,3145728+3145728,6291456+3145728,"
+                        "9437184+1048577", str);
+    free(str);
+    sparse_map_fini(&map);
+
+    assert_int_equal(0, sparse_map_split(1048576, 4, 1048576, &map));
+    assert_int_equal(1, map.sm_count);
+    sparse_map_fini(&map);
+
+    assert_int_equal(-EINVAL, sparse_map_split(100, 0, 1, &map));
+}
+
+static void test_pack(void **data)
+{
+    const struct pack_member members[] = {
+        { "0x200000401:0x1:0x0", 0, 4096, 0x1234 },
+        { "0x200000401:0x2:0x0", 4096, 10, 0xabcdef01 },
+    };
+    char container[64];
+    char ref[64];
+    uint64_t offset;
+    uint64_t length;
+    char *str;
+
+    (void) data;
+
+    assert_int_equal(0, pack_index2str(members, 2, true, &str));
+    assert_string_equal("0x200000401:0x1:0x0@0+4096/00001234,"
+                        "0x200000401:0x2:0x0@4096+10/abcdef01", str);
+    free(str);
+
+    assert_int_equal(0, pack_index2str(members, 2, false, &str));
+    assert_string_equal("0x200000401:0x1:0x0@0+4096,"
+                        "0x200000401:0x2:0x0@4096+10", str);
+    free(str);
+
+    assert_int_equal(2, pack_index_count("0x200000401:0x1:0x0@0+4096,"
+                                         "0x200000401:0x2:0x0@4096+10"));
+    assert_int_equal(0, pack_index_count(""));
+    assert_int_equal(0, pack_index_count(NULL));
+
+    assert_int_equal(0, pack_ref2str("fs:0x200000401:0x1:0x0.pack.1", 4096,
+                                     10, ref, sizeof(ref)));
+    assert_string_equal("pack@fs:0x200000401:0x1:0x0.pack.1@4096+10", ref);
+    assert_int_equal(0, str2pack_ref(ref, container, sizeof(container),
+                                     &offset, &length));
+    assert_string_equal("fs:0x200000401:0x1:0x0.pack.1", container);
+    assert_int_equal(4096, offset);
+    assert_int_equal(10, length);
+
+    /* the id of the container may hold '@' of its own */
+    assert_int_equal(0, str2pack_ref("pack@a@b@1+2", container,
+                                     sizeof(container), &offset, &length));
+    assert_string_equal("a@b", container);
+
+    /* object ids are not references, even ending with numbers */
+    assert_int_equal(-EINVAL, str2pack_ref("fs:0x200000401:0x1:0x0",
+                                           container, sizeof(container),
+                                           &offset, &length));
+    assert_int_equal(-EINVAL, str2pack_ref("fs:0x200000401:0x1:0x0:1:2",
+                                           container, sizeof(container),
+                                           &offset, &length));
+    assert_int_equal(-EINVAL, str2pack_ref("pack@@1+2", container,
+                                           sizeof(container), &offset,
+                                           &length));
+    assert_int_equal(-EINVAL, str2pack_ref("pack@a@1", container,
+                                           sizeof(container), &offset,
+                                           &length));
+    assert_int_equal(-EINVAL, str2pack_ref("pack@a@99999999999999999999+2",
+                                           container, sizeof(container),
+                                           &offset, &length));
+    assert_int_equal(-ENAMETOOLONG, str2pack_ref("pack@abcdefgh@1+2",
+                                                 container, 4, &offset,
+                                                 &length));
+}
+
+static void test_pack_ledger(void **data)
+{
+    char dir[] = "/tmp/pack_ledger.XXXXXX";
+    size_t removed;
+
+    (void) data;
+
+    assert_non_null(mkdtemp(dir));
+
+    assert_int_equal(0, pack_ledger_add(dir, "c.pack.1", "0x1:0x1:0x0",
+                                        &removed));
+    assert_int_equal(1, removed);
+    /* a member removed twice counts once */
+    assert_int_equal(0, pack_ledger_add(dir, "c.pack.1", "0x1:0x1:0x0",
+                                        &removed));
+    assert_int_equal(1, removed);
+    assert_int_equal(0, pack_ledger_add(dir, "c.pack.1", "0x1:0x2:0x0",
+                                        &removed));
+    assert_int_equal(2, removed);
+    assert_int_equal(0, pack_ledger_add(dir, "c.pack.2", "0x1:0x3:0x0",
+                                        &removed));
+    assert_int_equal(1, removed);
+
+    assert_int_equal(-EINVAL, pack_ledger_add(dir, "a/b", "0x1:0x1:0x0",
+                                              &removed));
+
+    assert_int_equal(0, pack_ledger_drop(dir, "c.pack.1"));
+    assert_int_equal(0, pack_ledger_drop(dir, "c.pack.1"));
+    assert_int_equal(0, pack_ledger_drop(dir, "c.pack.2"));
+    assert_int_equal(0, rmdir(dir));
+}
+
+static void test_layout_from_object_md(void **data)
+{
+    struct pho_attrs attrs = {0};
+    struct llapi_layout *layout;
+    uint64_t count;
+    uint64_t start;
+    uint64_t end;
+
+    (void) data;
+
+    pho_attr_set(&attrs, "program", "copytool");
+    assert_int_equal(-ENODATA, layout_from_object_md(&attrs, &layout));
+
+    /* component ids are not contiguous and not stored in order */
+    pho_attr_set(&attrs, "layout_comp4",
+                 "stripe_count=-1,stripe_size=1048576,pattern=raid0,"
+                 "extent_start=1048576,extent_end=EOF");
+    pho_attr_set(&attrs, "layout_comp1",
+                 "stripe_count=1,stripe_size=262144,pattern=raid0,"
+                 "extent_start=0,extent_end=1048576");
+    assert_int_equal(0, layout_from_object_md(&attrs, &layout));
+
+    assert_int_equal(0, llapi_layout_comp_use(layout,
+                                              LLAPI_LAYOUT_COMP_USE_FIRST));
+    assert_int_equal(0, llapi_layout_stripe_count_get(layout, &count));
+    assert_int_equal(1, count);
+    assert_int_equal(0, llapi_layout_comp_extent_get(layout, &start, &end));
+    assert_int_equal(0, start);
+    assert_int_equal(1048576, end);
+
+    assert_int_equal(0, llapi_layout_comp_use(layout,
+                                              LLAPI_LAYOUT_COMP_USE_NEXT));
+    assert_int_equal(0, llapi_layout_stripe_count_get(layout, &count));
+    assert_int_equal(LLAPI_LAYOUT_WIDE, count);
+    assert_int_equal(0, llapi_layout_comp_extent_get(layout, &start, &end));
+    assert_int_equal(1048576, start);
+    assert_int_equal(LUSTRE_EOF, end);
+
+    llapi_layout_free(layout);
+    pho_attrs_free(&attrs);
+}
+
+static void test_stripe_policy(void **data)
+{
+    struct stripe_policy policy;
+    struct llapi_layout *layout;
+    uint64_t value;
+    char pool[LOV_MAXPOOLNAME + 1];
+
+    (void) data;
+
+    assert_int_equal(-EINVAL, stripe_policy_parse("", &policy));
+    assert_int_equal(-EINVAL, stripe_policy_parse("1G", &policy));
+    assert_int_equal(-EINVAL, stripe_policy_parse("1X:4", &policy));
+    assert_int_equal(-EINVAL, stripe_policy_parse("1G:4,", &policy));
+    assert_int_equal(-EINVAL, stripe_policy_parse("1G:4:1M:pool:x", &policy));
+    assert_int_equal(-ERANGE, stripe_policy_parse("16777216T:4", &policy));
+
+    /* rules are not given in order */
+    assert_int_equal(0, stripe_policy_parse("100G:-1:4M:flash,1G:4", &policy));
+    assert_int_equal(2, policy.sp_count);
+
+    assert_int_equal(0, stripe_policy_layout(&policy, 1023 << 20, &layout));
+    assert_null(layout);
+
+    assert_int_equal(0, stripe_policy_layout(&policy, 1 << 30, &layout));
+    assert_non_null(layout);
+    assert_int_equal(0, llapi_layout_stripe_count_get(layout, &value));
+    assert_int_equal(4, value);
+    assert_int_equal(0, llapi_layout_stripe_size_get(layout, &value));
+    assert_int_equal(LLAPI_LAYOUT_DEFAULT, value);
+    llapi_layout_free(layout);
+
+    assert_int_equal(0, stripe_policy_layout(&policy, 200ULL << 30, &layout));
+    assert_non_null(layout);
+    assert_int_equal(0, llapi_layout_stripe_count_get(layout, &value));
+    assert_int_equal(LLAPI_LAYOUT_WIDE, value);
+    assert_int_equal(0, llapi_layout_stripe_size_get(layout, &value));
+    assert_int_equal(4 << 20, value);
+    assert_int_equal(0, llapi_layout_pool_name_get(layout, pool,
+                                                   sizeof(pool)));
+    assert_string_equal("flash", pool);
+    llapi_layout_free(layout);
+
+    stripe_policy_fini(&policy);
+}
+
+static void test_mdt_cache(void **data)
+{
+    struct mdt_cache cache;
+    int mdt_index;
+
+    (void) data;
+
+    mdt_cache_init(&cache);
+
+    assert_false(mdt_cache_lookup(&cache, 0x200000401, &mdt_index));
+
+    mdt_cache_insert(&cache, 0x200000401, 0);
+    mdt_cache_insert(&cache, 0x240000400, 1);
+    assert_true(mdt_cache_lookup(&cache, 0x200000401, &mdt_index));
+    assert_int_equal(0, mdt_index);
+    assert_true(mdt_cache_lookup(&cache, 0x240000400, &mdt_index));
+    assert_int_equal(1, mdt_index);
+
+    mdt_cache_insert(&cache, 0x240000400, 2);
+    assert_true(mdt_cache_lookup(&cache, 0x240000400, &mdt_index));
+    assert_int_equal(2, mdt_index);
+
+    mdt_cache_invalidate(&cache, 0x240000400);
+    assert_false(mdt_cache_lookup(&cache, 0x240000400, &mdt_index));
+    assert_true(mdt_cache_lookup(&cache, 0x200000401, &mdt_index));
+
+    mdt_cache_fini(&cache);
+}
+
+static void test_fid_cache(void **data)
+{
+    struct lu_fid fids[3] = {
+        { .f_seq = 0x200000401, .f_oid = 1 },
+        { .f_seq = 0x200000401, .f_oid = 2 },
+        { .f_seq = 0x200000401, .f_oid = 3 },
+    };
+    struct fid_cache cache;
+    char objid[16];
+
+    (void) data;
+
+    fid_cache_init(&cache, 2, 0);
+
+    assert_false(fid_cache_lookup(&cache, &fids[0], objid, sizeof(objid)));
+
+    fid_cache_insert(&cache, &fids[0], "obj1");
+    fid_cache_insert(&cache, &fids[1], "obj2");
+    assert_true(fid_cache_lookup(&cache, &fids[0], objid, sizeof(objid)));
+    assert_string_equal("obj1", objid);
+
+    /* fids[1] is the least recently used */
+    fid_cache_insert(&cache, &fids[2], "obj3");
+    assert_false(fid_cache_lookup(&cache, &fids[1], objid, sizeof(objid)));
+    assert_true(fid_cache_lookup(&cache, &fids[0], objid, sizeof(objid)));
+    assert_true(fid_cache_lookup(&cache, &fids[2], objid, sizeof(objid)));
+    assert_string_equal("obj3", objid);
+
+    /* the id does not fit */
+    assert_false(fid_cache_lookup(&cache, &fids[2], objid, 4));
+
+    fid_cache_insert(&cache, &fids[2], "new_obj3");
+    assert_true(fid_cache_lookup(&cache, &fids[2], objid, sizeof(objid)));
+    assert_string_equal("new_obj3", objid);
+
+    fid_cache_invalidate(&cache, &fids[2]);
+    assert_false(fid_cache_lookup(&cache, &fids[2], objid, sizeof(objid)));
+    assert_true(fid_cache_lookup(&cache, &fids[0], objid, sizeof(objid)));
+
+    fid_cache_fini(&cache);
+
+    /* entries expire after the TTL, even if they are used */
+    fid_cache_init(&cache, 2, 1);
+    fid_cache_insert(&cache, &fids[0], "obj1");
+    assert_true(fid_cache_lookup(&cache, &fids[0], objid, sizeof(objid)));
+    sleep(2);
+    assert_false(fid_cache_lookup(&cache, &fids[0], objid, sizeof(objid)));
+    fid_cache_fini(&cache);
+}
+
+static void test_uid_cache(void **data)
+{
+    struct uid_cache cache;
+    char *name;
+
+    (void) data;
+
+    uid_cache_init(&cache, 600, 60);
+
+    assert_int_equal(0, uid_cache_get(&cache, 0, &name));
+    assert_string_equal("root", name);
+    free(name);
+
+    /* served from the cache */
+    assert_int_equal(0, uid_cache_get(&cache, 0, &name));
+    assert_string_equal("root", name);
+    free(name);
+
+    /* unknown uids are cached too */
+    assert_int_equal(-ENOENT, uid_cache_get(&cache, 4242424, &name));
+    assert_null(name);
+    assert_int_equal(-ENOENT, uid_cache_get(&cache, 4242424, &name));
+
+    uid_cache_fini(&cache);
+}
+
 int main(void)
 {
     const struct CMUnitTest test_hints[] = {
         cmocka_unit_test(test_get_key_value_success),
         cmocka_unit_test(test_get_key_value_failure),
         cmocka_unit_test(test_process_hints),
+        cmocka_unit_test(test_throttle),
+        cmocka_unit_test(test_crc32c),
+        cmocka_unit_test(test_compress_parse),
+        cmocka_unit_test(test_sparse_map),
+        cmocka_unit_test(test_pack),
+        cmocka_unit_test(test_pack_ledger),
+        cmocka_unit_test(test_layout_from_object_md),
+        cmocka_unit_test(test_stripe_policy),
+        cmocka_unit_test(test_mdt_cache),
+        cmocka_unit_test(test_fid_cache),
+        cmocka_unit_test(test_uid_cache),
     };
 
     phobos_init();